@@ -0,0 +1,293 @@
+// -------------------------
+// Generic Grafcet Framework - Batch engine
+// -------------------------
+
+// MIT License:
+//
+// Copyright 2018 Gonçalo Santos
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+// NOTE(nox): Part of main.c, included after the single-instance engine: it steps InstanceCount
+// copies of the model in lockstep, sharing the constant topology. Per-instance data is laid out
+// as structure of arrays:
+// - States: bit-sliced, one bit per instance, InstanceWords words per state, so enabling and
+//   firing a transition are word operations over 64 instances at a time;
+// - ActivatedAt, InputActive, InputChangedAt and OutputActive: one element per instance,
+//   InstanceCount elements per state, input or output;
+// - Frozen, Suspended and ResetPending: bit-sliced like the states, per grafcet.
+// Scan rates are the ones of the single-instance engine, with the cycles counted by Tick.
+// Conditions and actions are the generated ones, compiled again with per-instance macros.
+// Transitions are polled while enabled instead of being marked dirty, so timers need no wheel.
+// The model macros (input(), output(), ...) are the per-instance ones from here on.
+typedef struct {
+    uint32_t InstanceCount;
+    uint32_t InstanceWords;
+
+    uint64_t *States;
+    uint64_t *ActivatedAt;
+    bool *InputActive;
+    uint64_t *InputChangedAt;
+    bool *OutputActive;
+    uint64_t *Frozen;
+    uint64_t *Suspended;
+    uint64_t *ResetPending;
+
+    uint64_t *Enabled;
+    uint64_t *Fired;
+
+    uint64_t Tick;
+    uint64_t ScannedAt[GrafcetCount];
+} batch;
+
+static batch Batch;
+
+#define batchStateWords(Id) (Batch.States + (size_t)(Id)*Batch.InstanceWords)
+#define batchIsActive(Id, Instance) ((batchStateWords(Id)[(Instance)/64] >> ((Instance)%64)) & 1)
+#define batchElement(Array, Index, Instance) (Batch.Array[(size_t)(Index)*Batch.InstanceCount + (Instance)])
+#define batchGrafcetWord(Array, Id, Instance) (Batch.Array[(size_t)(Id)*Batch.InstanceWords + (Instance)/64])
+
+#undef STATE_OUTPUT_FUNCTION
+#undef TRANSITION_CONDITION_FUNCTION
+#undef input
+#undef RE
+#undef FE
+#undef output
+#undef freeze
+#undef suspend
+#undef resume
+#undef reset
+#undef active
+#undef stateTimer
+
+typedef void batch_output_function(uint32_t Instance);
+typedef bool batch_condition_function(uint32_t Instance);
+#define STATE_OUTPUT_FUNCTION(Name) static void Name##_batch(uint32_t Instance)
+#define TRANSITION_CONDITION_FUNCTION(Name) static bool Name##_batch(uint32_t Instance)
+
+#define input(Label) batchElement(InputActive, IO_##Label, Instance)
+#define RE(Label) (input(Label) && batchElement(InputChangedAt, IO_##Label, Instance) > EdgesAfter)
+#define FE(Label) (!input(Label) && batchElement(InputChangedAt, IO_##Label, Instance) > EdgesAfter)
+#define output(Label) (batchElement(OutputActive, IO_##Label, Instance) = true)
+#define freeze(Id) (batchGrafcetWord(Frozen, Id, Instance) |= 1ull << (Instance%64))
+#define suspend(Id) (batchGrafcetWord(Suspended, Id, Instance) |= 1ull << (Instance%64), freeze(Id))
+#define resume(Id) (batchGrafcetWord(Suspended, Id, Instance) &= ~(1ull << (Instance%64)))
+#define reset(Id) (batchGrafcetWord(ResetPending, Id, Instance) |= 1ull << (Instance%64))
+#define active(Name) batchIsActive(State_X##Name, Instance)
+#define stateTimer(Id) ((ScanTime - batchElement(ActivatedAt, Id, Instance))/1000000)
+
+#define OUTPUTS_AND_CONDITIONS
+#include GENERATED_HEADER
+#undef OUTPUTS_AND_CONDITIONS
+
+#define batchOutputEntry(Name) [State_##Name] = stateAction_##Name##_batch,
+static batch_output_function *const BatchOutputs[StateCount] = { MODEL_STATES(batchOutputEntry) };
+#define batchConditionEntry(Name) [Transition_##Name] = transitionCondition_##Name##_batch,
+static batch_condition_function *const BatchConditions[TransitionCount] = { MODEL_TRANSITIONS(batchConditionEntry) };
+
+static void initBatch(uint32_t InstanceCount) {
+    free(Batch.States);
+    free(Batch.ActivatedAt);
+    free(Batch.InputActive);
+    free(Batch.InputChangedAt);
+    free(Batch.OutputActive);
+    free(Batch.Frozen);
+    free(Batch.Suspended);
+    free(Batch.ResetPending);
+    free(Batch.Enabled);
+    free(Batch.Fired);
+
+    int MaxTransitions = 1;
+    for(int GrafcetId = 0; GrafcetId < GrafcetCount; ++GrafcetId) {
+        if(Model.Grafcets[GrafcetId].TransitionCount > MaxTransitions) {
+            MaxTransitions = Model.Grafcets[GrafcetId].TransitionCount;
+        }
+    }
+
+    Batch.InstanceCount = InstanceCount;
+    Batch.InstanceWords = (InstanceCount + 63)/64;
+    Batch.States = calloc((size_t)StateCount*Batch.InstanceWords, sizeof(uint64_t));
+    Batch.ActivatedAt = calloc((size_t)StateCount*InstanceCount, sizeof(uint64_t));
+    Batch.InputActive = calloc((size_t)ArrayCount(Inputs)*InstanceCount, sizeof(bool));
+    Batch.InputChangedAt = calloc((size_t)ArrayCount(Inputs)*InstanceCount, sizeof(uint64_t));
+    Batch.OutputActive = calloc((size_t)ArrayCount(Outputs)*InstanceCount, sizeof(bool));
+    Batch.Frozen = calloc((size_t)GrafcetCount*Batch.InstanceWords, sizeof(uint64_t));
+    Batch.Suspended = calloc((size_t)GrafcetCount*Batch.InstanceWords, sizeof(uint64_t));
+    Batch.ResetPending = calloc((size_t)GrafcetCount*Batch.InstanceWords, sizeof(uint64_t));
+    Batch.Enabled = calloc(Batch.InstanceWords, sizeof(uint64_t));
+    Batch.Fired = calloc((size_t)MaxTransitions*Batch.InstanceWords, sizeof(uint64_t));
+    Batch.Tick = 0;
+    memset(Batch.ScannedAt, 0, sizeof(Batch.ScannedAt));
+
+    for(state_id Id = 0; Id < StateCount; ++Id) {
+        if((Model.InitialStates[Id/64] >> (Id % 64)) & 1) {
+            uint64_t *Words = batchStateWords(Id);
+            for(uint32_t Word = 0; Word < Batch.InstanceWords; ++Word) {
+                uint32_t Valid = InstanceCount - 64*Word;
+                Words[Word] = Valid >= 64 ? ~0ull : (1ull << Valid) - 1;
+            }
+        }
+    }
+}
+
+static void beginBatchCycle() {
+    memset(Batch.OutputActive, 0, (size_t)ArrayCount(Outputs)*Batch.InstanceCount*sizeof(bool));
+    ++Batch.Tick;
+}
+
+static void toggleBatchInput(int Index, uint32_t Instance) {
+    batchElement(InputActive, Index, Instance) = !batchElement(InputActive, Index, Instance);
+    batchElement(InputChangedAt, Index, Instance) = Batch.Tick;
+}
+
+// NOTE(nox): Every step of the grafcet takes its initial value in the instances being reset; the
+// batch engine already visits every step for the outputs, so this needs no bookkeeping
+static void resetBatchGrafcet(int GrafcetId) {
+    const grafcet *Grafcet = Model.Grafcets + GrafcetId;
+    uint32_t Words = Batch.InstanceWords;
+    uint64_t *Reset = Batch.ResetPending + (size_t)GrafcetId*Words;
+    const uint64_t *Initial = Model.InitialStates;
+    for(state_id Id = Grafcet->FirstState; Id < Grafcet->FirstState + Grafcet->StateCount; ++Id) {
+        uint64_t *Active = batchStateWords(Id);
+        uint64_t *ActivatedAt = &batchElement(ActivatedAt, Id, 0);
+        bool InitiallyActive = (Initial[Id/64] >> (Id % 64)) & 1;
+        for(uint32_t Word = 0; Word < Words; ++Word) {
+            if(InitiallyActive) {
+                for(uint64_t Bits = Reset[Word] & ~Active[Word]; Bits; Bits &= Bits - 1) {
+                    ActivatedAt[64*Word + __builtin_ctzll(Bits)] = ScanTime;
+                }
+                Active[Word] |= Reset[Word];
+            } else {
+                Active[Word] &= ~Reset[Word];
+            }
+        }
+    }
+    memset(Reset, 0, Words*sizeof(uint64_t));
+}
+
+static void runBatchActions(int GrafcetId) {
+    const grafcet *Grafcet = Model.Grafcets + GrafcetId;
+    for(state_id Id = Grafcet->FirstState; Id < Grafcet->FirstState + Grafcet->StateCount; ++Id) {
+        const uint64_t *Active = batchStateWords(Id);
+        for(uint32_t Word = 0; Word < Batch.InstanceWords; ++Word) {
+            for(uint64_t Bits = Active[Word]; Bits; Bits &= Bits - 1) {
+                BatchOutputs[Id](64*Word + __builtin_ctzll(Bits));
+            }
+        }
+    }
+}
+
+static void scanBatchGrafcet(int GrafcetId) {
+    const grafcet *Grafcet = Model.Grafcets + GrafcetId;
+    uint32_t Words = Batch.InstanceWords;
+    uint64_t *Frozen = Batch.Frozen + (size_t)GrafcetId*Words;
+    uint64_t *Enabled = Batch.Enabled;
+
+    const uint64_t *Reset = Batch.ResetPending + (size_t)GrafcetId*Words;
+    for(uint32_t Word = 0; Word < Words; ++Word) {
+        if(Reset[Word]) {
+            resetBatchGrafcet(GrafcetId);
+            break;
+        }
+    }
+
+    // NOTE(nox): Calculate transitions: the instances where every previous state is active and
+    // the grafcet is not frozen, then the condition of each of them
+    for(int Index = 0; Index < Grafcet->TransitionCount; ++Index) {
+        transition_id Id = Grafcet->FirstTransition + Index;
+        uint64_t *Fired = Batch.Fired + (size_t)Index*Words;
+        for(uint32_t Word = 0; Word < Words; ++Word) {
+            Enabled[Word] = ~Frozen[Word];
+        }
+        for(const state_id *Prev = previousStatesBegin(Id); Prev != previousStatesEnd(Id); ++Prev) {
+            const uint64_t *Active = batchStateWords(*Prev);
+            for(uint32_t Word = 0; Word < Words; ++Word) {
+                Enabled[Word] &= Active[Word];
+            }
+        }
+        for(uint32_t Word = 0; Word < Words; ++Word) {
+            uint64_t Result = 0;
+            for(uint64_t Bits = Enabled[Word]; Bits; Bits &= Bits - 1) {
+                int Bit = __builtin_ctzll(Bits);
+                if(BatchConditions[Id](64*Word + Bit)) {
+                    Result |= 1ull << Bit;
+                }
+            }
+            Fired[Word] = Result;
+        }
+    }
+
+    // NOTE(nox): Deactivate above
+    for(int Index = 0; Index < Grafcet->TransitionCount; ++Index) {
+        transition_id Id = Grafcet->FirstTransition + Index;
+        const uint64_t *Fired = Batch.Fired + (size_t)Index*Words;
+        for(const state_id *Prev = previousStatesBegin(Id); Prev != previousStatesEnd(Id); ++Prev) {
+            uint64_t *Active = batchStateWords(*Prev);
+            for(uint32_t Word = 0; Word < Words; ++Word) {
+                Active[Word] &= ~Fired[Word];
+            }
+        }
+    }
+
+    // NOTE(nox): Activate below
+    for(int Index = 0; Index < Grafcet->TransitionCount; ++Index) {
+        transition_id Id = Grafcet->FirstTransition + Index;
+        const uint64_t *Fired = Batch.Fired + (size_t)Index*Words;
+        for(const state_id *Next = nextStatesBegin(Id); Next != nextStatesEnd(Id); ++Next) {
+            uint64_t *Active = batchStateWords(*Next);
+            uint64_t *ActivatedAt = &batchElement(ActivatedAt, *Next, 0);
+            for(uint32_t Word = 0; Word < Words; ++Word) {
+                Active[Word] |= Fired[Word];
+                for(uint64_t Bits = Fired[Word]; Bits; Bits &= Bits - 1) {
+                    ActivatedAt[64*Word + __builtin_ctzll(Bits)] = ScanTime;
+                }
+            }
+        }
+    }
+
+    runBatchActions(GrafcetId);
+}
+
+static void scanBatch() {
+    for(int GrafcetId = 0; GrafcetId < GrafcetCount; ++GrafcetId) {
+        EdgesAfter = Batch.ScannedAt[GrafcetId];
+        if(grafcetDue(GrafcetId, Batch.Tick)) {
+            Batch.ScannedAt[GrafcetId] = Batch.Tick;
+            scanBatchGrafcet(GrafcetId);
+        } else {
+            runBatchActions(GrafcetId);
+        }
+    }
+    memcpy(Batch.Frozen, Batch.Suspended, (size_t)GrafcetCount*Batch.InstanceWords*sizeof(uint64_t));
+}
+
+// NOTE(nox): True when the instance is in the same situation, with the same outputs, as the
+// single-instance engine
+static bool batchInstanceMatches(uint32_t Instance) {
+    for(state_id Id = 0; Id < StateCount; ++Id) {
+        if(batchIsActive(Id, Instance) != isActive(Id)) {
+            return false;
+        }
+    }
+    for(int Index = 0; Index < ArrayCount(Outputs); ++Index) {
+        if(batchElement(OutputActive, Index, Instance) != outputActive(Index)) {
+            return false;
+        }
+    }
+    return true;
+}
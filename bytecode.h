@@ -0,0 +1,166 @@
+// -------------------------
+// Generic Grafcet Framework - Condition and action bytecode
+// -------------------------
+
+// MIT License:
+//
+// Copyright 2018 Gonçalo Santos
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+
+#if !defined(BYTECODE_H)
+#define BYTECODE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// NOTE(nox): Conditions and actions compiled by the preprocessor for a stack machine, so a model
+// loaded at run time does not need them as C. An instruction is one word: the opcode in the low
+// byte and an unsigned operand in the other 24 bits. The programs of all the conditions are
+// packed in one array and those of the actions in another, each starting at the offset given
+// for its transition or state; a condition ends in Return, with its result on the stack, and an
+// action in End. Jumps are forward and relative to the next instruction.
+//
+// Anything outside the grammar the preprocessor compiles (input, RE, FE, active, timer, integer
+// constants, comparisons, !, && and || in conditions; output, freeze, suspend, resume, reset,
+// if and else in actions) becomes a Native instruction, which calls the compiled function.
+typedef enum {
+    Op_Input,           // push input(Operand)
+    Op_RisingEdge,      // push RE(Operand)
+    Op_FallingEdge,     // push FE(Operand)
+    Op_Active,          // push active(Operand), with the state id
+    Op_Timer,           // push timer(Operand), with the state id
+    Op_Constant,        // push Operand
+    Op_Not,
+    Op_Bool,            // top = (top != 0)
+    Op_Less,
+    Op_LessEqual,
+    Op_Greater,
+    Op_GreaterEqual,
+    Op_Equal,
+    Op_NotEqual,
+    Op_AndJump,         // &&: jump keeping the top when it is 0, otherwise pop it
+    Op_OrJump,          // ||: jump keeping the top when it is not 0, otherwise pop it
+    Op_JumpIfFalse,     // pop, and jump when it was 0
+    Op_Jump,
+    Op_Return,          // end of a condition, with the result on top
+    Op_NativeCondition, // push the compiled condition of transition Operand
+
+    Op_Output,
+    Op_Freeze,
+    Op_Suspend,
+    Op_Resume,
+    Op_Reset,
+    Op_End,             // end of an action
+    Op_NativeAction,    // run the compiled action of state Operand
+
+    Op_Count
+} code_op;
+
+#define CODE_STACK_SIZE 16
+#define CODE_MAX_OPERAND 0xffffffu
+
+#define codeInstruction(Op, Operand) ((uint32_t)(Op) | (uint32_t)(Operand) << 8)
+#define codeOp(Instruction) ((Instruction) & 0xff)
+#define codeOperand(Instruction) ((Instruction) >> 8)
+
+// NOTE(nox): Upper bounds of the operands, for checking code that was not compiled with the engine
+typedef struct {
+    uint32_t InputCount;
+    uint32_t OutputCount;
+    uint32_t StateCount;
+    uint32_t TransitionCount;
+    uint32_t GrafcetCount;
+    bool AllowNative;
+} code_limits;
+
+// NOTE(nox): True when the program at Offset of Code (Size words) is one the interpreter can run
+// without checks: it ends in Return (a condition) or End (an action) inside the array, every
+// operand is in range, every jump lands on an instruction of the program, and the stack never
+// underflows nor grows past CODE_STACK_SIZE, whatever the path to an instruction. Depths is
+// scratch space of Size entries, all -1, and is left that way.
+static bool verifyCode(const uint32_t *Code, uint32_t Size, uint32_t Offset, bool Condition, code_limits Limits,
+                       int8_t *Depths) {
+    bool Valid = false;
+    int Depth = 0;
+    bool Reachable = true;
+    uint32_t At = Offset, Last = Offset;
+    for(; At < Size; ++At) {
+        if(Depths[At] >= 0) {
+            if(Reachable && Depth != Depths[At]) {
+                break;
+            }
+            Depth = Depths[At];
+            Reachable = true;
+        }
+        uint32_t Operand = codeOperand(Code[At]);
+        int Pops = 0, Pushes = 0;
+        uint32_t Limit = CODE_MAX_OPERAND + 1;
+        bool Jumps = false, Ends = false;
+        switch(codeOp(Code[At])) {
+            case Op_Input: case Op_RisingEdge: case Op_FallingEdge: { Pushes = 1; Limit = Limits.InputCount; } break;
+            case Op_Active: case Op_Timer: { Pushes = 1; Limit = Limits.StateCount; } break;
+            case Op_Constant: { Pushes = 1; } break;
+            case Op_Not: case Op_Bool: { Pops = Pushes = 1; } break;
+            case Op_Less: case Op_LessEqual: case Op_Greater: case Op_GreaterEqual: case Op_Equal: case Op_NotEqual: {
+                Pops = 2; Pushes = 1;
+            } break;
+            case Op_AndJump: case Op_OrJump: case Op_JumpIfFalse: { Pops = 1; Jumps = true; } break;
+            case Op_Jump: { Jumps = true; } break;
+            case Op_Return: { Ends = Condition; Pops = 1; } break;
+            case Op_NativeCondition: { Pushes = 1; Limit = Limits.AllowNative ? Limits.TransitionCount : 0; } break;
+            case Op_Output: { Limit = Limits.OutputCount; } break;
+            case Op_Freeze: case Op_Suspend: case Op_Resume: case Op_Reset: { Limit = Limits.GrafcetCount; } break;
+            case Op_End: { Ends = !Condition; } break;
+            case Op_NativeAction: { Limit = Limits.AllowNative ? Limits.StateCount : 0; } break;
+            default: { Limit = 0; } break;
+        }
+        if(!Reachable || Operand >= Limit || Depth < Pops) {
+            break;
+        }
+        if(codeOp(Code[At]) == Op_Return || codeOp(Code[At]) == Op_End) {
+            // NOTE(nox): No jump may go past the end of the program
+            Valid = Ends && Depth == Pops && Last <= At;
+            break;
+        }
+        if(Jumps) {
+            // NOTE(nox): AndJump and OrJump keep their operand when they jump
+            int JumpDepth = Depth - (codeOp(Code[At]) == Op_JumpIfFalse);
+            uint64_t Target = (uint64_t)At + 1 + Operand;
+            if(Target >= Size || (Depths[Target] >= 0 && Depths[Target] != JumpDepth)) {
+                break;
+            }
+            Depths[Target] = (int8_t)JumpDepth;
+            Last = Target > Last ? (uint32_t)Target : Last;
+            Reachable = (codeOp(Code[At]) != Op_Jump);
+        }
+        Depth += Pushes - Pops;
+        if(Depth > CODE_STACK_SIZE) {
+            break;
+        }
+    }
+    if(Offset < Size) {
+        Last = At > Last ? At : Last;
+        memset(Depths + Offset, -1, (Last < Size ? Last + 1 : Size) - Offset);
+    }
+    return Valid;
+}
+
+#endif
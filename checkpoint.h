@@ -0,0 +1,132 @@
+// -------------------------
+// Generic Grafcet Framework - Checkpoints
+// -------------------------
+
+// MIT License:
+//
+// Copyright 2018 Gonçalo Santos
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+
+#if !defined(CHECKPOINT_H)
+#define CHECKPOINT_H
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// NOTE(nox): A checkpoint is a header followed by a payload of 64 bit words laid out by the
+// engine. Its size depends on the model and on how many steps are active, never on how long the
+// engine ran. It is written to a temporary file renamed over the previous checkpoint, so a crash
+// in the middle leaves the old one intact; a checksum of the payload catches anything else.
+#define CHECKPOINT_MAGIC 0x4b434747 // NOTE(nox): "GGCK"
+#define CHECKPOINT_VERSION 2
+
+typedef struct {
+    uint32_t Magic;
+    uint32_t Version;
+    uint64_t TopologyHash;
+    uint64_t Cycle;
+    uint64_t ScanTime;
+    uint32_t StateWordCount;
+    uint32_t ActiveCount;
+    uint32_t GrafcetCount;
+    uint32_t InputCount;
+    uint32_t OutputCount;
+    uint32_t PayloadWords;
+    uint64_t Checksum;
+} checkpoint_header;
+
+static uint64_t checkpointChecksum(const uint64_t *Words, uint32_t Count) {
+    uint64_t Hash = 14695981039346656037ull;
+    for(uint32_t Index = 0; Index < Count; ++Index) {
+        Hash = (Hash ^ Words[Index])*1099511628211ull;
+    }
+    return Hash;
+}
+
+static bool writeCheckpoint(const char *Path, checkpoint_header Header, const uint64_t *Payload) {
+    char TemporaryPath[4096];
+    if(snprintf(TemporaryPath, sizeof(TemporaryPath), "%s.tmp", Path) >= (int)sizeof(TemporaryPath)) {
+        return false;
+    }
+    Header.Magic = CHECKPOINT_MAGIC;
+    Header.Version = CHECKPOINT_VERSION;
+    Header.Checksum = checkpointChecksum(Payload, Header.PayloadWords);
+
+    int Fd = open(TemporaryPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(Fd < 0) {
+        return false;
+    }
+    size_t PayloadSize = Header.PayloadWords*sizeof(uint64_t);
+    bool Written = (write(Fd, &Header, sizeof(Header)) == (ssize_t)sizeof(Header) &&
+                    write(Fd, Payload, PayloadSize) == (ssize_t)PayloadSize);
+    close(Fd);
+    if(!Written || rename(TemporaryPath, Path) != 0) {
+        unlink(TemporaryPath);
+        return false;
+    }
+    return true;
+}
+
+typedef struct {
+    void *Map;
+    size_t Size;
+    const checkpoint_header *Header;
+    const uint64_t *Payload;
+} checkpoint;
+
+// NOTE(nox): Maps and validates a checkpoint; the caller checks it matches its model
+static bool openCheckpoint(checkpoint *Checkpoint, const char *Path) {
+    memset(Checkpoint, 0, sizeof(*Checkpoint));
+    int Fd = open(Path, O_RDONLY);
+    if(Fd < 0) {
+        return false;
+    }
+    struct stat Stat;
+    if(fstat(Fd, &Stat) == 0 && Stat.st_size >= (off_t)sizeof(checkpoint_header)) {
+        Checkpoint->Size = (size_t)Stat.st_size;
+        Checkpoint->Map = mmap(0, Checkpoint->Size, PROT_READ, MAP_PRIVATE, Fd, 0);
+    }
+    close(Fd);
+    if(!Checkpoint->Map || Checkpoint->Map == MAP_FAILED) {
+        Checkpoint->Map = 0;
+        return false;
+    }
+
+    const checkpoint_header *Header = Checkpoint->Header = (const checkpoint_header *)Checkpoint->Map;
+    Checkpoint->Payload = (const uint64_t *)(Header + 1);
+    return (Header->Magic == CHECKPOINT_MAGIC && Header->Version == CHECKPOINT_VERSION &&
+            Checkpoint->Size == sizeof(checkpoint_header) + Header->PayloadWords*sizeof(uint64_t) &&
+            checkpointChecksum(Checkpoint->Payload, Header->PayloadWords) == Header->Checksum);
+}
+
+static void closeCheckpoint(checkpoint *Checkpoint) {
+    if(Checkpoint->Map) {
+        munmap(Checkpoint->Map, Checkpoint->Size);
+    }
+    memset(Checkpoint, 0, sizeof(*Checkpoint));
+}
+
+#endif
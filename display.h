@@ -0,0 +1,123 @@
+// -------------------------
+// Generic Grafcet Framework - Terminal display
+// -------------------------
+
+// MIT License:
+//
+// Copyright 2018 Gonçalo Santos
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+#if !defined(DISPLAY_H)
+#define DISPLAY_H
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// NOTE(nox): Line-diffing terminal renderer. A frame is built line by line, then compared with
+// the one on screen: only the lines that changed are rewritten (cursor move, text, clear to end
+// of line), and the whole update goes out in a single write().
+#define DISPLAY_MAX_LINES 256
+#define DISPLAY_LINE_SIZE 160
+
+typedef struct {
+    int LineCount;
+    char Lines[DISPLAY_MAX_LINES][DISPLAY_LINE_SIZE];
+} display_frame;
+
+typedef struct {
+    display_frame Frames[2];
+    int Current;
+    bool Drawn;
+
+    int OutputSize;
+    char Output[DISPLAY_MAX_LINES*(DISPLAY_LINE_SIZE + 16) + 32];
+} display;
+
+static void beginFrame(display *Display) {
+    Display->Frames[Display->Current].LineCount = 0;
+}
+
+static void displayLine(display *Display, const char *Format, ...) {
+    display_frame *Frame = Display->Frames + Display->Current;
+    if(Frame->LineCount < DISPLAY_MAX_LINES) {
+        va_list Args;
+        va_start(Args, Format);
+        vsnprintf(Frame->Lines[Frame->LineCount++], DISPLAY_LINE_SIZE, Format, Args);
+        va_end(Args);
+    }
+}
+
+// NOTE(nox): Adds one line per '\n' terminated line of Text
+static void displayText(display *Display, const char *Text) {
+    while(*Text) {
+        const char *End = strchr(Text, '\n');
+        int Length = End ? (int)(End - Text) : (int)strlen(Text);
+        displayLine(Display, "%.*s", Length, Text);
+        Text += Length + (End != 0);
+    }
+}
+
+static void appendOutput(display *Display, const char *Format, ...) {
+    va_list Args;
+    va_start(Args, Format);
+    int Size = sizeof(Display->Output) - Display->OutputSize;
+    int Written = vsnprintf(Display->Output + Display->OutputSize, Size, Format, Args);
+    Display->OutputSize += Written < Size ? Written : Size - 1;
+    va_end(Args);
+}
+
+static void endFrame(display *Display) {
+    display_frame *Frame = Display->Frames + Display->Current;
+    display_frame *Shown = Display->Frames + !Display->Current;
+
+    Display->OutputSize = 0;
+    if(!Display->Drawn) {
+        appendOutput(Display, "\033[H\033[J");
+    }
+    for(int Line = 0; Line < Frame->LineCount; ++Line) {
+        if(!Display->Drawn || Line >= Shown->LineCount || strcmp(Frame->Lines[Line], Shown->Lines[Line]) != 0) {
+            appendOutput(Display, "\033[%d;1H%s\033[K", Line + 1, Frame->Lines[Line]);
+        }
+    }
+    if(Display->Drawn && Frame->LineCount < Shown->LineCount) {
+        appendOutput(Display, "\033[%d;1H\033[J", Frame->LineCount + 1);
+    }
+    // NOTE(nox): Leave the cursor below the frame, so anything printed afterwards follows it
+    appendOutput(Display, "\033[%d;1H", Frame->LineCount + 1);
+
+    for(char *Output = Display->Output; Display->OutputSize > 0;) {
+        ssize_t Written = write(STDOUT_FILENO, Output, Display->OutputSize);
+        if(Written < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        Output += Written;
+        Display->OutputSize -= Written;
+    }
+
+    Display->Drawn = true;
+    Display->Current = !Display->Current;
+}
+
+#endif
@@ -0,0 +1,134 @@
+// -------------------------
+// Generic Grafcet Framework - Flight recorder decoder
+// -------------------------
+
+// MIT License:
+//
+// Copyright 2018 Gonçalo Santos
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "flight_recorder.h"
+
+#define ArrayCount(arr) ((sizeof(arr))/sizeof(*arr))
+
+// NOTE(nox): Prints a flight recorder dump, oldest event first, with the ids named after the
+// model it is compiled with (the same -DMODEL and -DGENERATED_HEADER as main.out)
+#if !defined(MODEL)
+#define MODEL "mixer.h"
+#endif
+#if !defined(GENERATED_HEADER)
+#define GENERATED_HEADER "preprocessor_output.h"
+#endif
+
+#include MODEL
+#include GENERATED_HEADER
+
+#define stateNameWriter(Name) [State_##Name] = #Name + 1,
+static const char *StateNames[StateCount] = { MODEL_STATES(stateNameWriter) };
+#define transitionNameWriter(Name) [Transition_##Name] = #Name,
+static const char *TransitionNames[TransitionCount] = { MODEL_TRANSITIONS(transitionNameWriter) };
+#define outputNameWriter(Name) #Name
+static const char *OutputNames[] = { outputMacro(outputNameWriter) };
+
+static const char *KindNames[Event_KindCount] = {
+    "activated", "deactivated", "fired", "frozen", "released", "output on", "output off", "reset",
+};
+
+static const char *eventName(flight_event *Event, char *Buffer, int Size) {
+    const char *Name = 0;
+    switch(Event->Kind) {
+        case Event_StepActivated:
+        case Event_StepDeactivated:
+        {
+            Name = Event->Id < StateCount ? StateNames[Event->Id] : 0;
+        } break;
+
+        case Event_TransitionFired:
+        {
+            Name = Event->Id < TransitionCount ? TransitionNames[Event->Id] : 0;
+        } break;
+
+        case Event_GrafcetFrozen:
+        case Event_GrafcetReleased:
+        case Event_GrafcetReset:
+        {
+            snprintf(Buffer, Size, "grafcet %u", Event->Id);
+            Name = Buffer;
+        } break;
+
+        case Event_OutputOn:
+        case Event_OutputOff:
+        {
+            Name = Event->Id < ArrayCount(OutputNames) ? OutputNames[Event->Id] : 0;
+        } break;
+    }
+    if(!Name) {
+        snprintf(Buffer, Size, "#%u", Event->Id);
+        Name = Buffer;
+    }
+    return Name;
+}
+
+int main(int Argc, char *Argv[]) {
+    if(Argc != 2) {
+        fprintf(stderr, "Usage: %s dump\n", Argv[0]);
+        return -1;
+    }
+    FILE *File = fopen(Argv[1], "rb");
+    if(!File) {
+        fprintf(stderr, "Could not open %s\n", Argv[1]);
+        return -1;
+    }
+
+    flight_recorder_header Header;
+    if(fread(&Header, sizeof(Header), 1, File) != 1 || Header.Magic != FLIGHT_RECORDER_MAGIC ||
+       Header.Version != FLIGHT_RECORDER_VERSION || Header.EventSize != sizeof(flight_event) ||
+       !Header.Capacity || (Header.Capacity & (Header.Capacity - 1))) {
+        fprintf(stderr, "%s is not a flight recorder dump\n", Argv[1]);
+        return -1;
+    }
+    if(Header.StateCount != StateCount || Header.TransitionCount != TransitionCount ||
+       Header.GrafcetCount != GrafcetCount || Header.OutputCount != ArrayCount(OutputNames)) {
+        fprintf(stderr, "%s was dumped by another model\n", Argv[1]);
+        return -1;
+    }
+    flight_event *Events = malloc(Header.Capacity*sizeof(flight_event));
+    if(!Events || fread(Events, sizeof(flight_event), Header.Capacity, File) != Header.Capacity) {
+        fprintf(stderr, "%s is truncated\n", Argv[1]);
+        return -1;
+    }
+    fclose(File);
+
+    uint64_t First = Header.Head > Header.Capacity ? Header.Head - Header.Capacity : 0;
+    printf("%llu events recorded, showing the last %llu\n", (unsigned long long)Header.Head,
+           (unsigned long long)(Header.Head - First));
+    for(uint64_t Index = First; Index < Header.Head; ++Index) {
+        flight_event *Event = Events + (Index & (Header.Capacity - 1));
+        char Buffer[32];
+        printf("%12.3lf  %-11s  %s\n", (double)Event->Time/1e6,
+               Event->Kind < Event_KindCount ? KindNames[Event->Kind] : "?", eventName(Event, Buffer, sizeof(Buffer)));
+    }
+    free(Events);
+    return 0;
+}
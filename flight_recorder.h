@@ -0,0 +1,126 @@
+// -------------------------
+// Generic Grafcet Framework - Flight recorder
+// -------------------------
+
+// MIT License:
+//
+// Copyright 2018 Gonçalo Santos
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+
+#if !defined(FLIGHT_RECORDER_H)
+#define FLIGHT_RECORDER_H
+
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+// NOTE(nox): The last FLIGHT_RECORDER_SIZE engine events, kept in a ring that is never read
+// while running: a writer claims a slot and overwrites the oldest event. With several writers
+// (Shared) the slot is claimed with one atomic add, so scan threads never wait on each other;
+// a single writer just bumps the head, which avoids the locked instruction. A dump is the header followed by the raw ring; the
+// events of a slot claimed but not yet written when the dump is taken may be torn.
+typedef enum {
+    Event_StepActivated,
+    Event_StepDeactivated,
+    Event_TransitionFired,
+    Event_GrafcetFrozen,
+    Event_GrafcetReleased,
+    Event_OutputOn,
+    Event_OutputOff,
+    Event_GrafcetReset,
+
+    Event_KindCount
+} event_kind;
+
+typedef struct {
+    uint64_t Time;
+    uint32_t Id;
+    uint32_t Kind;
+} flight_event;
+
+#define FLIGHT_RECORDER_SIZE (1 << 16)
+#define FLIGHT_RECORDER_MAGIC 0x52464747 // NOTE(nox): "GGFR"
+#define FLIGHT_RECORDER_VERSION 1
+
+typedef struct {
+    uint32_t Magic;
+    uint32_t Version;
+    uint32_t Capacity;
+    uint32_t EventSize;
+    uint32_t StateCount;
+    uint32_t TransitionCount;
+    uint32_t GrafcetCount;
+    uint32_t OutputCount;
+    // NOTE(nox): Number of events ever recorded; the ring holds the last Capacity of them
+    uint64_t Head;
+} flight_recorder_header;
+
+typedef struct {
+    _Atomic uint64_t Head;
+    bool Shared;
+    flight_event Events[FLIGHT_RECORDER_SIZE];
+} flight_recorder;
+
+static inline void recordEvent(flight_recorder *Recorder, event_kind Kind, uint32_t Id, uint64_t Time) {
+    uint64_t Index;
+    if(Recorder->Shared) {
+        Index = atomic_fetch_add_explicit(&Recorder->Head, 1, memory_order_relaxed);
+    } else {
+        Index = atomic_load_explicit(&Recorder->Head, memory_order_relaxed);
+        atomic_store_explicit(&Recorder->Head, Index + 1, memory_order_relaxed);
+    }
+    flight_event *Event = Recorder->Events + (Index & (FLIGHT_RECORDER_SIZE - 1));
+    Event->Time = Time;
+    Event->Id = Id;
+    Event->Kind = Kind;
+}
+
+// NOTE(nox): Only uses open(), write() and close(), so it can be called from a signal handler
+static bool dumpFlightRecorder(flight_recorder *Recorder, flight_recorder_header Header, const char *Path) {
+    int Fd = open(Path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(Fd < 0) {
+        return false;
+    }
+    Header.Magic = FLIGHT_RECORDER_MAGIC;
+    Header.Version = FLIGHT_RECORDER_VERSION;
+    Header.Capacity = FLIGHT_RECORDER_SIZE;
+    Header.EventSize = sizeof(flight_event);
+    Header.Head = atomic_load_explicit(&Recorder->Head, memory_order_acquire);
+
+    bool Written = true;
+    const char *Chunks[] = {(const char *)&Header, (const char *)Recorder->Events};
+    size_t Sizes[] = {sizeof(Header), sizeof(Recorder->Events)};
+    for(int Chunk = 0; Chunk < 2 && Written; ++Chunk) {
+        for(size_t Offset = 0; Offset < Sizes[Chunk];) {
+            ssize_t Count = write(Fd, Chunks[Chunk] + Offset, Sizes[Chunk] - Offset);
+            if(Count <= 0) {
+                Written = false;
+                break;
+            }
+            Offset += (size_t)Count;
+        }
+    }
+    close(Fd);
+    return Written;
+}
+
+#endif
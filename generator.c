@@ -0,0 +1,261 @@
+// -------------------------
+// Generic Grafcet Framework - Synthetic model generator
+// -------------------------
+
+// MIT License:
+//
+// Copyright 2018 Gonçalo Santos
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ArrayCount(arr) ((sizeof(arr))/sizeof(*arr))
+
+// NOTE(nox): Writes a model header in the same syntax as mixer.h, to be fed to the preprocessor
+// and compiled with -DMODEL. Supervisors are grafcets 0 .. Supervisors-1: they hold the worker
+// grafcets assigned to them (with freeze(), or suspend() and resume() for odd supervisors) and
+// reset them when they let them go. Workers cycle through three shapes:
+// - a sequence of Length steps;
+// - a parallel divergence into Width branches of Length steps, joined by one convergence;
+// - a selection between Width branches of Length steps, with mutually exclusive conditions.
+// Conditions read inputs, timers of the previous step and, Links times per worker, a step of
+// another grafcet, so every kind of dependency of the engine is exercised. With WorkerPeriod,
+// the workers are scanned every WorkerPeriod milliseconds and the supervisors every cycle.
+typedef struct {
+    int Grafcets;
+    int Length;
+    int Width;
+    int Inputs;
+    int Outputs;
+    int Supervisors;
+    int Links;
+    int WorkerPeriod;
+    uint32_t Seed;
+} generator_options;
+
+static uint32_t Random;
+
+static uint32_t nextRandom() {
+    Random ^= Random << 13;
+    Random ^= Random >> 17;
+    Random ^= Random << 5;
+    return Random;
+}
+
+static generator_options Options = {16, 8, 4, 32, 16, 2, 1, 0, 1};
+static int LinksLeft;
+
+static int randomInput() {
+    return nextRandom() % Options.Inputs;
+}
+
+static void emitAction() {
+    if(nextRandom() % 2) {
+        printf(" output(O%d);", nextRandom() % Options.Outputs);
+    }
+}
+
+static void emitState(int Grafcet, char *Name, bool Initial) {
+    printf("    %s(%d, %s, {", Initial ? "newInitialState" : "newState", Grafcet, Name);
+    emitAction();
+    printf(" });\n");
+}
+
+// NOTE(nox): Condition to leave the step Previous of grafcet Grafcet
+static void emitCondition(int Grafcet, char *Previous) {
+    uint32_t Kind = nextRandom() % 8;
+    int Input = randomInput();
+    if(Kind == 0) {
+        printf("(timer(%s)>=%d)", Previous, 10*(1 + nextRandom() % 20));
+    } else if(Kind == 1 && Options.Grafcets > 1 && LinksLeft > 0) {
+        --LinksLeft;
+        int Other = Options.Supervisors + nextRandom() % Options.Grafcets;
+        if(Other == Grafcet) {
+            Other = Options.Supervisors + (Other - Options.Supervisors + 1) % Options.Grafcets;
+        }
+        printf("(input(I%d) || active(g%d_0))", Input, Other);
+    } else {
+        printf("(%sinput(I%d))", Kind % 2 ? "!" : "", Input);
+    }
+}
+
+static void emitBranch(int Grafcet, int Branch, char *Entry) {
+    char Previous[64], Name[64];
+    snprintf(Previous, sizeof(Previous), "%s", Entry);
+    for(int Step = 1; Step <= Options.Length; ++Step) {
+        snprintf(Name, sizeof(Name), "g%d_%d_%d", Grafcet, Branch, Step);
+        emitState(Grafcet, Name, false);
+        if(Step > 1) {
+            printf("    newTransition(%d, t%d_%d_%d, ARR(State_X%s), ARR(State_X%s), ", Grafcet, Grafcet, Branch,
+                   Step, Previous, Name);
+            emitCondition(Grafcet, Previous);
+            printf(");\n");
+        }
+        strcpy(Previous, Name);
+    }
+}
+
+static void emitWorker(int Grafcet) {
+    int Shape = (Grafcet - Options.Supervisors) % 3;
+    int Width = Shape == 0 ? 1 : Options.Width;
+    char Initial[64];
+    snprintf(Initial, sizeof(Initial), "g%d_0", Grafcet);
+    LinksLeft = Options.Links;
+
+    printf("\n    // NOTE(nox): Worker grafcet %d (%s)\n", Grafcet,
+           Shape == 0 ? "sequence" : Shape == 1 ? "parallel" : "selection");
+    if(Options.WorkerPeriod) {
+        printf("    grafcetPeriod(%d, %d);\n", Grafcet, Options.WorkerPeriod);
+    }
+    emitState(Grafcet, Initial, true);
+    for(int Branch = 0; Branch < Width; ++Branch) {
+        emitBranch(Grafcet, Branch, Initial);
+    }
+
+    if(Shape == 1) {
+        printf("    newTransition(%d, t%d_fork, ARR(State_X%s), ARR(", Grafcet, Grafcet, Initial);
+        for(int Branch = 0; Branch < Width; ++Branch) {
+            printf("%sState_Xg%d_%d_1", Branch ? ", " : "", Grafcet, Branch);
+        }
+        printf("), ");
+        emitCondition(Grafcet, Initial);
+        printf(");\n");
+
+        printf("    newTransition(%d, t%d_join, ARR(", Grafcet, Grafcet);
+        for(int Branch = 0; Branch < Width; ++Branch) {
+            printf("%sState_Xg%d_%d_%d", Branch ? ", " : "", Grafcet, Branch, Options.Length);
+        }
+        printf("), ARR(State_X%s), (input(I%d)));\n", Initial, randomInput());
+    } else {
+        // NOTE(nox): Branch B is chosen when the inputs First.. encode B in binary
+        int First = randomInput();
+        int Bits = 0;
+        while((1 << Bits) < Width) {
+            ++Bits;
+        }
+        for(int Branch = 0; Branch < Width; ++Branch) {
+            printf("    newTransition(%d, t%d_%d_in, ARR(State_X%s), ARR(State_Xg%d_%d_1), ", Grafcet, Grafcet,
+                   Branch, Initial, Grafcet, Branch);
+            if(Bits) {
+                printf("(");
+                for(int Bit = 0; Bit < Bits; ++Bit) {
+                    printf("%s%sinput(I%d)", Bit ? " && " : "", (Branch >> Bit) & 1 ? "" : "!",
+                           (First + Bit) % Options.Inputs);
+                }
+                printf(")");
+            } else {
+                emitCondition(Grafcet, Initial);
+            }
+            printf(");\n");
+            printf("    newTransition(%d, t%d_%d_out, ARR(State_Xg%d_%d_%d), ARR(State_X%s), ", Grafcet, Grafcet,
+                   Branch, Grafcet, Branch, Options.Length, Initial);
+            char Last[64];
+            snprintf(Last, sizeof(Last), "g%d_%d_%d", Grafcet, Branch, Options.Length);
+            emitCondition(Grafcet, Last);
+            printf(");\n");
+        }
+    }
+}
+
+static void emitWorkerOrders(int Supervisor, const char *Order) {
+    for(int Grafcet = Options.Supervisors + Supervisor; Grafcet < Options.Supervisors + Options.Grafcets;
+        Grafcet += Options.Supervisors) {
+        printf(" %s(%d);", Order, Grafcet);
+    }
+}
+
+static void emitSupervisor(int Supervisor) {
+    int Input = randomInput();
+    int Watched = Options.Supervisors + nextRandom() % Options.Grafcets;
+    bool Suspends = Supervisor % 2;
+    printf("\n    // NOTE(nox): Supervisor grafcet %d\n", Supervisor);
+    printf("    newInitialState(%d, s%d_1, {", Supervisor, Supervisor);
+    if(Suspends) {
+        emitWorkerOrders(Supervisor, "resume");
+    }
+    printf(" });\n");
+    printf("    newTransition(%d, s%d_1, ARR(State_Xs%d_1), ARR(State_Xs%d_2), (RE(I%d) && !active(g%d_0)));\n",
+           Supervisor, Supervisor, Supervisor, Supervisor, Input, Watched);
+    printf("    newState(%d, s%d_2, {", Supervisor, Supervisor);
+    emitWorkerOrders(Supervisor, Suspends ? "suspend" : "freeze");
+    printf(" });\n");
+    printf("    newTransition(%d, s%d_2, ARR(State_Xs%d_2), ARR(State_Xs%d_3), (!input(I%d)));\n",
+           Supervisor, Supervisor, Supervisor, Supervisor, Input);
+    printf("    newState(%d, s%d_3, {", Supervisor, Supervisor);
+    emitWorkerOrders(Supervisor, "reset");
+    printf(" });\n");
+    printf("    newTransition(%d, s%d_3, ARR(State_Xs%d_3), ARR(State_Xs%d_1), (true));\n",
+           Supervisor, Supervisor, Supervisor, Supervisor);
+}
+
+static bool parseOption(char *Name, char *Value) {
+    struct { char *Name; int *Field; int Minimum; } Fields[] = {
+        {"--grafcets", &Options.Grafcets, 1}, {"--length", &Options.Length, 1},
+        {"--width", &Options.Width, 1}, {"--inputs", &Options.Inputs, 1},
+        {"--outputs", &Options.Outputs, 1}, {"--supervisors", &Options.Supervisors, 0},
+        {"--links", &Options.Links, 0}, {"--worker-period", &Options.WorkerPeriod, 0},
+    };
+    if(strcmp(Name, "--seed") == 0) {
+        Options.Seed = (uint32_t)strtoul(Value, 0, 10);
+        return Options.Seed != 0;
+    }
+    for(int Index = 0; Index < ArrayCount(Fields); ++Index) {
+        if(strcmp(Name, Fields[Index].Name) == 0) {
+            *Fields[Index].Field = atoi(Value);
+            return *Fields[Index].Field >= Fields[Index].Minimum;
+        }
+    }
+    return false;
+}
+
+int main(int ArgCount, char **Args) {
+    for(int ArgIndex = 1; ArgIndex < ArgCount; ArgIndex += 2) {
+        if(ArgIndex + 1 >= ArgCount || !parseOption(Args[ArgIndex], Args[ArgIndex + 1])) {
+            fprintf(stderr, "Usage: %s [--grafcets N] [--length N] [--width N] [--inputs N] [--outputs N]\n"
+                    "       [--supervisors N] [--links N] [--worker-period ms] [--seed N]\n", Args[0]);
+            return -1;
+        }
+    }
+    Random = Options.Seed;
+
+    printf("// NOTE(nox): Synthetic model generated by %s", Args[0]);
+    for(int ArgIndex = 1; ArgIndex < ArgCount; ++ArgIndex) {
+        printf(" %s", Args[ArgIndex]);
+    }
+    printf("\n\n#if defined(MODEL_DECLARATIONS)\n");
+    for(int Supervisor = 0; Supervisor < Options.Supervisors; ++Supervisor) {
+        emitSupervisor(Supervisor);
+    }
+    for(int Grafcet = Options.Supervisors; Grafcet < Options.Supervisors + Options.Grafcets; ++Grafcet) {
+        emitWorker(Grafcet);
+    }
+
+    printf("\n#else\n\n#define inputMacro(W) W(QUIT, 'q')");
+    for(int Input = 0; Input < Options.Inputs; ++Input) {
+        printf(", W(I%d, 0)", Input);
+    }
+    printf("\n#define outputMacro(W) W(O0)");
+    for(int Output = 1; Output < Options.Outputs; ++Output) {
+        printf(", W(O%d)", Output);
+    }
+    printf("\n\n#endif\n");
+}
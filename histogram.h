@@ -0,0 +1,90 @@
+// -------------------------
+// Generic Grafcet Framework - Histograms
+// -------------------------
+
+// MIT License:
+//
+// Copyright 2018 Gonçalo Santos
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#if !defined(HISTOGRAM_H)
+#define HISTOGRAM_H
+
+// NOTE(nox): Fixed-bucket log-linear histogram of nanosecond values: values below 8 have their
+// own bucket, above that every power of two is split in 8 buckets (~12% resolution). Recording
+// is a couple of instructions and never allocates.
+#define HISTOGRAM_SUB_BUCKET_BITS 3
+#define HISTOGRAM_MAX_BITS 40
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BUCKET_BITS + 1) << HISTOGRAM_SUB_BUCKET_BITS)
+
+typedef struct {
+    uint64_t Count;
+    uint64_t Sum;
+    uint64_t Min;
+    uint64_t Max;
+    uint32_t Buckets[HISTOGRAM_BUCKETS];
+} histogram;
+
+static inline int histogramBucket(uint64_t Value) {
+    if(Value < (1u << HISTOGRAM_SUB_BUCKET_BITS)) {
+        return (int)Value;
+    }
+    int Exponent = 63 - __builtin_clzll(Value);
+    if(Exponent >= HISTOGRAM_MAX_BITS) {
+        return HISTOGRAM_BUCKETS - 1;
+    }
+    int SubBucket = (int)(Value >> (Exponent - HISTOGRAM_SUB_BUCKET_BITS)) & ((1 << HISTOGRAM_SUB_BUCKET_BITS) - 1);
+    return ((Exponent - HISTOGRAM_SUB_BUCKET_BITS + 1) << HISTOGRAM_SUB_BUCKET_BITS) + SubBucket;
+}
+
+// NOTE(nox): Smallest value that falls in Bucket
+static inline uint64_t histogramBucketValue(int Bucket) {
+    if(Bucket < (1 << HISTOGRAM_SUB_BUCKET_BITS)) {
+        return Bucket;
+    }
+    int Exponent = (Bucket >> HISTOGRAM_SUB_BUCKET_BITS) + HISTOGRAM_SUB_BUCKET_BITS - 1;
+    uint64_t SubBucket = Bucket & ((1 << HISTOGRAM_SUB_BUCKET_BITS) - 1);
+    return (1ull << Exponent) | (SubBucket << (Exponent - HISTOGRAM_SUB_BUCKET_BITS));
+}
+
+static inline void histogramRecord(histogram *Histogram, uint64_t Value) {
+    if(!Histogram->Count || Value < Histogram->Min) Histogram->Min = Value;
+    if(Value > Histogram->Max) Histogram->Max = Value;
+    ++Histogram->Count;
+    Histogram->Sum += Value;
+    ++Histogram->Buckets[histogramBucket(Value)];
+}
+
+// NOTE(nox): Percentile in [0, 100], resolved to the start of its bucket
+static uint64_t histogramPercentile(histogram *Histogram, double Percentile) {
+    uint64_t Target = (uint64_t)(Histogram->Count*Percentile/100.0);
+    if(Target >= Histogram->Count) {
+        return Histogram->Max;
+    }
+    uint64_t Seen = 0;
+    for(int Bucket = 0; Bucket < HISTOGRAM_BUCKETS; ++Bucket) {
+        Seen += Histogram->Buckets[Bucket];
+        if(Seen > Target) {
+            uint64_t Value = histogramBucketValue(Bucket);
+            return Value < Histogram->Min ? Histogram->Min : Value;
+        }
+    }
+    return Histogram->Max;
+}
+
+#endif
@@ -0,0 +1,217 @@
+// -------------------------
+// Generic Grafcet Framework - Input acquisition
+// -------------------------
+
+// MIT License:
+//
+// Copyright 2018 Gonçalo Santos
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+
+#if !defined(INPUT_ACQUISITION_H)
+#define INPUT_ACQUISITION_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "input_source.h"
+#include "scheduler.h"
+
+// NOTE(nox): Inputs are acquired by a thread of their own, so reading them neither takes time
+// from the cycle nor waits for it: the thread sleeps on an epoll set with every source (the
+// terminal, FIFOs, pipes and the connections to a local socket, e.g. from a plant simulator),
+// decodes what arrives as soon as it arrives and pushes the edges, stamped with the time they
+// were read, to the ring the scan drains at the start of each cycle. The thread is the ring's
+// only producer. Regular files can not be polled, so they are read whole when added.
+#define INPUT_MAX_SOURCES 16
+#define INPUT_WAKE_EVENT INPUT_MAX_SOURCES
+#define INPUT_LISTENER_EVENT (INPUT_MAX_SOURCES + 1)
+
+typedef struct {
+    int Epoll;
+    int Wake;
+    int Listener;
+    const char *ListenerPath;
+    input_queue *Queue;
+    pthread_t Thread;
+    bool Running;
+
+    uint16_t KeyInputs[256];
+    input_source Sources[INPUT_MAX_SOURCES];
+    uint64_t RefusedConnections;
+} input_acquisition;
+
+static bool initInputAcquisition(input_acquisition *Acquisition, input_queue *Queue) {
+    memset(Acquisition, 0, sizeof(*Acquisition));
+    Acquisition->Queue = Queue;
+    Acquisition->Listener = -1;
+    for(int Index = 0; Index < INPUT_MAX_SOURCES; ++Index) {
+        Acquisition->Sources[Index].Fd = -1;
+    }
+    Acquisition->Epoll = epoll_create1(EPOLL_CLOEXEC);
+    Acquisition->Wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event Event = {.events = EPOLLIN, .data.u32 = INPUT_WAKE_EVENT};
+    return (Acquisition->Epoll >= 0 && Acquisition->Wake >= 0 &&
+            epoll_ctl(Acquisition->Epoll, EPOLL_CTL_ADD, Acquisition->Wake, &Event) == 0);
+}
+
+static void removeInputSource(input_acquisition *Acquisition, input_source *Source) {
+    epoll_ctl(Acquisition->Epoll, EPOLL_CTL_DEL, Source->Fd, 0);
+    closeInputSource(Source);
+}
+
+// NOTE(nox): Before the thread starts, sources are added by the caller; afterwards only by the
+// thread itself, for the connections it accepts
+static bool addInputSource(input_acquisition *Acquisition, int Fd, bool OwnsFd) {
+    input_source *Source = 0;
+    for(int Index = 0; Index < INPUT_MAX_SOURCES && !Source; ++Index) {
+        if(Acquisition->Sources[Index].Fd < 0) {
+            Source = Acquisition->Sources + Index;
+        }
+    }
+    if(!Source || !openInputSource(Source, Fd, OwnsFd, decodeKeys, Acquisition->KeyInputs)) {
+        if(Source) {
+            closeInputSource(Source);
+        } else if(OwnsFd) {
+            close(Fd);
+        }
+        return false;
+    }
+
+    struct epoll_event Event = {.events = EPOLLIN, .data.u32 = (uint32_t)(Source - Acquisition->Sources)};
+    if(epoll_ctl(Acquisition->Epoll, EPOLL_CTL_ADD, Fd, &Event) == 0) {
+        return true;
+    }
+    if(errno == EPERM) {
+        readInputSource(Source, Acquisition->Queue, getNanoseconds());
+        closeInputSource(Source);
+        return true;
+    }
+    closeInputSource(Source);
+    return false;
+}
+
+// NOTE(nox): Every connection to the socket is a source with the same keys as the others
+static bool listenInputSocket(input_acquisition *Acquisition, const char *Path) {
+    struct sockaddr_un Address = {.sun_family = AF_UNIX};
+    if(strlen(Path) >= sizeof(Address.sun_path)) {
+        return false;
+    }
+    strcpy(Address.sun_path, Path);
+
+    struct stat Stat;
+    if(stat(Path, &Stat) == 0 && S_ISSOCK(Stat.st_mode)) {
+        unlink(Path);
+    }
+    int Listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    struct epoll_event Event = {.events = EPOLLIN, .data.u32 = INPUT_LISTENER_EVENT};
+    if(Listener < 0 || bind(Listener, (struct sockaddr *)&Address, sizeof(Address)) != 0 ||
+       listen(Listener, 4) != 0 || epoll_ctl(Acquisition->Epoll, EPOLL_CTL_ADD, Listener, &Event) != 0) {
+        if(Listener >= 0) {
+            close(Listener);
+        }
+        return false;
+    }
+    Acquisition->Listener = Listener;
+    Acquisition->ListenerPath = Path;
+    return true;
+}
+
+static void acceptInputConnections(input_acquisition *Acquisition) {
+    for(;;) {
+        int Fd = accept(Acquisition->Listener, 0, 0);
+        if(Fd < 0) {
+            if(errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            break;
+        }
+        if(!addInputSource(Acquisition, Fd, true)) {
+            ++Acquisition->RefusedConnections;
+        }
+    }
+}
+
+static void *runInputAcquisition(void *Data) {
+    input_acquisition *Acquisition = (input_acquisition *)Data;
+    struct epoll_event Events[INPUT_MAX_SOURCES + 2];
+    for(;;) {
+        int Count = epoll_wait(Acquisition->Epoll, Events, ArrayCount(Events), -1);
+        if(Count < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        uint64_t Time = getNanoseconds();
+        for(int Index = 0; Index < Count; ++Index) {
+            uint32_t Id = Events[Index].data.u32;
+            if(Id == INPUT_WAKE_EVENT) {
+                return 0;
+            } else if(Id == INPUT_LISTENER_EVENT) {
+                acceptInputConnections(Acquisition);
+            } else {
+                input_source *Source = Acquisition->Sources + Id;
+                if(Source->Fd >= 0 && !readInputSource(Source, Acquisition->Queue, Time)) {
+                    removeInputSource(Acquisition, Source);
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+static bool startInputAcquisition(input_acquisition *Acquisition) {
+    Acquisition->Running = (pthread_create(&Acquisition->Thread, 0, runInputAcquisition, Acquisition) == 0);
+    return Acquisition->Running;
+}
+
+// NOTE(nox): Wakes the thread through the eventfd, then closes every source (restoring the
+// terminal) and the socket
+static void stopInputAcquisition(input_acquisition *Acquisition) {
+    if(Acquisition->Running) {
+        uint64_t One = 1;
+        while(write(Acquisition->Wake, &One, sizeof(One)) < 0 && errno == EINTR);
+        pthread_join(Acquisition->Thread, 0);
+        Acquisition->Running = false;
+    }
+    for(int Index = 0; Index < INPUT_MAX_SOURCES; ++Index) {
+        if(Acquisition->Sources[Index].Fd >= 0) {
+            removeInputSource(Acquisition, Acquisition->Sources + Index);
+        }
+    }
+    if(Acquisition->Listener >= 0) {
+        close(Acquisition->Listener);
+        unlink(Acquisition->ListenerPath);
+    }
+    if(Acquisition->Wake >= 0) {
+        close(Acquisition->Wake);
+    }
+    if(Acquisition->Epoll >= 0) {
+        close(Acquisition->Epoll);
+    }
+}
+
+#endif
@@ -0,0 +1,181 @@
+// -------------------------
+// Generic Grafcet Framework - Input sources
+// -------------------------
+
+// MIT License:
+//
+// Copyright 2018 Gonçalo Santos
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+#if !defined(INPUT_SOURCE_H)
+#define INPUT_SOURCE_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+// NOTE(nox): Inputs arrive from sources: a file descriptor drained with non-blocking read()s
+// and a decoder that turns its bytes into edges. Edges are queued with the time they were read
+// and applied by the engine at most one per input and cycle, so two changes of an input within
+// one cycle still give RE() and FE() a cycle each.
+typedef enum {
+    Edge_Fall,
+    Edge_Rise,
+    Edge_Toggle,
+} edge_kind;
+
+typedef struct {
+    uint64_t Time;
+    uint16_t Input;
+    uint8_t Kind;
+} input_edge;
+
+#define INPUT_QUEUE_SIZE 1024
+
+// NOTE(nox): Wait-free single-producer single-consumer ring: only the producer writes Write and
+// the edges, only the consumer writes Read, and each index is published with release and read
+// with acquire, so an edge is complete before the consumer sees it and its slot is free before
+// the producer reuses it. The indices live on cache lines of their own. Dropped counts the edges
+// the producer found no room for and the invalid ones the consumer discarded, so both update it
+// atomically; MaxDepth is the consumer's high-water mark.
+typedef struct {
+    _Alignas(64) _Atomic uint32_t Write;
+    _Atomic uint64_t Dropped;
+    _Alignas(64) _Atomic uint32_t Read;
+    uint32_t MaxDepth;
+    input_edge Edges[INPUT_QUEUE_SIZE];
+} input_queue;
+
+static void pushInputEdge(input_queue *Queue, uint64_t Time, int Input, edge_kind Kind) {
+    uint32_t Write = atomic_load_explicit(&Queue->Write, memory_order_relaxed);
+    if(Write - atomic_load_explicit(&Queue->Read, memory_order_acquire) < INPUT_QUEUE_SIZE) {
+        Queue->Edges[Write % INPUT_QUEUE_SIZE] = (input_edge){Time, (uint16_t)Input, (uint8_t)Kind};
+        atomic_store_explicit(&Queue->Write, Write + 1, memory_order_release);
+    } else {
+        atomic_fetch_add_explicit(&Queue->Dropped, 1, memory_order_relaxed);
+    }
+}
+
+static uint32_t inputQueueDepth(input_queue *Queue) {
+    return (atomic_load_explicit(&Queue->Write, memory_order_acquire) -
+            atomic_load_explicit(&Queue->Read, memory_order_relaxed));
+}
+
+// NOTE(nox): Consumer side: the oldest edge, or 0 when the ring is empty; popInputEdge frees it
+static const input_edge *peekInputEdge(input_queue *Queue) {
+    uint32_t Read = atomic_load_explicit(&Queue->Read, memory_order_relaxed);
+    if(Read == atomic_load_explicit(&Queue->Write, memory_order_acquire)) {
+        return 0;
+    }
+    return Queue->Edges + Read % INPUT_QUEUE_SIZE;
+}
+
+static void popInputEdge(input_queue *Queue) {
+    uint32_t Read = atomic_load_explicit(&Queue->Read, memory_order_relaxed);
+    atomic_store_explicit(&Queue->Read, Read + 1, memory_order_release);
+}
+
+typedef struct input_source input_source;
+
+#define INPUT_DECODER(Name) void Name(input_source *Source, input_queue *Queue, const uint8_t *Bytes, int Count, \
+                                      uint64_t Time)
+typedef INPUT_DECODER(input_decoder);
+
+struct input_source {
+    int Fd;
+    bool OwnsFd;
+    input_decoder *Decode;
+    // NOTE(nox): For the key decoder: input toggled by every byte value, plus one (0 for none),
+    // shared by every source with the same keys
+    const uint16_t *KeyInputs;
+
+    bool RestoreTerminal;
+    struct termios Terminal;
+};
+
+static INPUT_DECODER(decodeKeys) {
+    for(int Index = 0; Index < Count; ++Index) {
+        int Input = Source->KeyInputs[Bytes[Index]];
+        if(Input) {
+            pushInputEdge(Queue, Time, Input - 1, Edge_Toggle);
+        }
+    }
+}
+
+static void bindInputKey(uint16_t *KeyInputs, char Key, int Input) {
+    if(Key) {
+        KeyInputs[(uint8_t)Key] = (uint16_t)(Input + 1);
+    }
+}
+
+// NOTE(nox): A terminal is switched to non-canonical mode without echo, so every key is
+// delivered as soon as it is pressed; closeInputSource restores it, and closes the descriptor
+// if the source owns it
+static bool openInputSource(input_source *Source, int Fd, bool OwnsFd, input_decoder *Decode,
+                            const uint16_t *KeyInputs) {
+    memset(Source, 0, sizeof(*Source));
+    Source->Fd = Fd;
+    Source->OwnsFd = OwnsFd;
+    Source->Decode = Decode;
+    Source->KeyInputs = KeyInputs;
+    if(isatty(Fd) && tcgetattr(Fd, &Source->Terminal) == 0) {
+        struct termios Raw = Source->Terminal;
+        Raw.c_lflag &= ~(ICANON | ECHO);
+        Raw.c_cc[VMIN] = 0;
+        Raw.c_cc[VTIME] = 0;
+        Source->RestoreTerminal = (tcsetattr(Fd, TCSANOW, &Raw) == 0);
+    }
+    int Flags = fcntl(Fd, F_GETFL);
+    return Flags >= 0 && fcntl(Fd, F_SETFL, Flags | O_NONBLOCK) == 0;
+}
+
+static void closeInputSource(input_source *Source) {
+    if(Source->RestoreTerminal) {
+        tcsetattr(Source->Fd, TCSANOW, &Source->Terminal);
+    }
+    if(Source->OwnsFd) {
+        close(Source->Fd);
+    }
+    Source->RestoreTerminal = false;
+    Source->OwnsFd = false;
+    Source->Fd = -1;
+}
+
+// NOTE(nox): Drains everything available; returns false once the source reached end of file or
+// failed, so it can be closed
+static bool readInputSource(input_source *Source, input_queue *Queue, uint64_t Time) {
+    uint8_t Buffer[512];
+    for(;;) {
+        ssize_t Count = read(Source->Fd, Buffer, sizeof(Buffer));
+        if(Count > 0) {
+            Source->Decode(Source, Queue, Buffer, (int)Count, Time);
+        } else if(Count < 0 && errno == EINTR) {
+            continue;
+        } else {
+            return Count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+        }
+    }
+}
+
+#endif
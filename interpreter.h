@@ -0,0 +1,202 @@
+// -------------------------
+// Generic Grafcet Framework - Bytecode interpreter
+// -------------------------
+
+// MIT License:
+//
+// Copyright 2018 Gonçalo Santos
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+
+#if !defined(INTERPRETER_H)
+#define INTERPRETER_H
+
+// NOTE(nox): Part of main.c, included before the scans: the bytecode engine (--bytecode) runs
+// the programs of bytecode.h instead of calling the compiled conditions and actions. The
+// enabled dirty transitions of a grafcet (or its active states) are gathered in a batch and run
+// in one pass over the code: every instruction jumps straight to the handler of the next one
+// through a table of label addresses, and the last instruction of a program to the first of the
+// next program, so there is no loop nor switch in between.
+static bool UseBytecode;
+
+#define CODE_BATCH_SIZE 256
+
+#define dispatchCode() goto *Handlers[codeOp(Instruction = *At++)]
+#define codeArgument() codeOperand(Instruction)
+
+// NOTE(nox): Runs the programs of Ids, from Code at their Offsets. A condition sets the bit of
+// its transition in FiredTransitions when it holds.
+static void runCode(const uint32_t *Code, const uint32_t *Offsets, const uint32_t *Ids, int Count) {
+    static void *const Handlers[Op_Count] = {
+        [Op_Input] = &&Input, [Op_RisingEdge] = &&RisingEdge, [Op_FallingEdge] = &&FallingEdge,
+        [Op_Active] = &&Active, [Op_Timer] = &&Timer, [Op_Constant] = &&Constant, [Op_Not] = &&Not,
+        [Op_Bool] = &&Bool, [Op_Less] = &&Less, [Op_LessEqual] = &&LessEqual, [Op_Greater] = &&Greater,
+        [Op_GreaterEqual] = &&GreaterEqual, [Op_Equal] = &&Equal, [Op_NotEqual] = &&NotEqual,
+        [Op_AndJump] = &&AndJump, [Op_OrJump] = &&OrJump, [Op_JumpIfFalse] = &&JumpIfFalse, [Op_Jump] = &&Jump,
+        [Op_Return] = &&Return, [Op_NativeCondition] = &&NativeCondition, [Op_Output] = &&Output,
+        [Op_Freeze] = &&Freeze, [Op_Suspend] = &&Suspend, [Op_Resume] = &&Resume, [Op_Reset] = &&Reset,
+        [Op_End] = &&End, [Op_NativeAction] = &&NativeAction,
+    };
+    int64_t Stack[CODE_STACK_SIZE];
+    int64_t *Top = Stack;
+    uint32_t Instruction;
+    uint64_t Since = EdgesAfter;
+    int Index = 0;
+    if(Count == 0) {
+        return;
+    }
+    const uint32_t *At = Code + Offsets[Ids[0]];
+    dispatchCode();
+
+Input:
+    *Top++ = Inputs[codeArgument()].Active;
+    dispatchCode();
+RisingEdge:
+    *Top++ = Inputs[codeArgument()].Active && Inputs[codeArgument()].ChangedAt > Since;
+    dispatchCode();
+FallingEdge:
+    *Top++ = !Inputs[codeArgument()].Active && Inputs[codeArgument()].ChangedAt > Since;
+    dispatchCode();
+Active:
+    *Top++ = isActive(codeArgument());
+    dispatchCode();
+Timer:
+    *Top++ = (int64_t)stateTimer(codeArgument());
+    dispatchCode();
+Constant:
+    *Top++ = codeArgument();
+    dispatchCode();
+Not:
+    Top[-1] = !Top[-1];
+    dispatchCode();
+Bool:
+    Top[-1] = (Top[-1] != 0);
+    dispatchCode();
+Less:
+    --Top; Top[-1] = Top[-1] < Top[0];
+    dispatchCode();
+LessEqual:
+    --Top; Top[-1] = Top[-1] <= Top[0];
+    dispatchCode();
+Greater:
+    --Top; Top[-1] = Top[-1] > Top[0];
+    dispatchCode();
+GreaterEqual:
+    --Top; Top[-1] = Top[-1] >= Top[0];
+    dispatchCode();
+Equal:
+    --Top; Top[-1] = Top[-1] == Top[0];
+    dispatchCode();
+NotEqual:
+    --Top; Top[-1] = Top[-1] != Top[0];
+    dispatchCode();
+AndJump:
+    if(Top[-1]) {
+        --Top;
+    } else {
+        At += codeArgument();
+    }
+    dispatchCode();
+OrJump:
+    if(Top[-1]) {
+        At += codeArgument();
+    } else {
+        --Top;
+    }
+    dispatchCode();
+JumpIfFalse:
+    if(!*--Top) {
+        At += codeArgument();
+    }
+    dispatchCode();
+Jump:
+    At += codeArgument();
+    dispatchCode();
+NativeCondition:
+    *Top++ = TransitionConditions[codeArgument()]();
+    dispatchCode();
+Output:
+    setOutput(codeArgument());
+    dispatchCode();
+Freeze:
+    freeze(codeArgument());
+    dispatchCode();
+Suspend:
+    suspend(codeArgument());
+    dispatchCode();
+Resume:
+    resume(codeArgument());
+    dispatchCode();
+Reset:
+    reset(codeArgument());
+    dispatchCode();
+NativeAction:
+    StateOutputs[codeArgument()]();
+    dispatchCode();
+Return:
+    FiredTransitions[Ids[Index]/64] |= (uint64_t)(*--Top != 0) << (Ids[Index] % 64);
+End:
+    if(++Index == Count) {
+        return;
+    }
+    At = Code + Offsets[Ids[Index]];
+    dispatchCode();
+}
+
+#undef dispatchCode
+#undef codeArgument
+
+// NOTE(nox): Same as evaluateTransitionWords, with the conditions of the enabled transitions
+// run as one batch
+static void evaluateTransitionCode(int FirstWord, int EndWord) {
+    uint32_t Batch[CODE_BATCH_SIZE];
+    int Count = 0;
+    for(int Word = FirstWord; Word < EndWord; ++Word) {
+        for(uint64_t Bits = DirtyTransitions[Word]; Bits; Bits &= Bits - 1) {
+            uint32_t Id = 64*Word + __builtin_ctzll(Bits);
+            if(allStatesActive(Model.TransitionPreviousMasks[Id])) {
+                Batch[Count++] = Id;
+            }
+        }
+        DirtyTransitions[Word] = 0;
+        FiredTransitions[Word] = 0;
+        if(Count > CODE_BATCH_SIZE - 64) {
+            runCode(Model.ConditionCode, Model.ConditionOffsets, Batch, Count);
+            Count = 0;
+        }
+    }
+    runCode(Model.ConditionCode, Model.ConditionOffsets, Batch, Count);
+}
+
+static void runStateActionCode(int FirstWord, int EndWord) {
+    uint32_t Batch[CODE_BATCH_SIZE];
+    int Count = 0;
+    for(int Word = FirstWord; Word < EndWord; ++Word) {
+        for(uint64_t Bits = ActiveStates[Word]; Bits; Bits &= Bits - 1) {
+            Batch[Count++] = 64*Word + __builtin_ctzll(Bits);
+        }
+        if(Count > CODE_BATCH_SIZE - 64) {
+            runCode(Model.ActionCode, Model.ActionOffsets, Batch, Count);
+            Count = 0;
+        }
+    }
+    runCode(Model.ActionCode, Model.ActionOffsets, Batch, Count);
+}
+
+#endif
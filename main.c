@@ -26,305 +26,2103 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <fcntl.h>
 #include <unistd.h>
-#include <sys/ioctl.h>
-#include <sys/select.h>
-#include <termios.h>
-#include <stropts.h>
+#include <sys/resource.h>
 
-// Linux (POSIX) implementation of _kbhit().
-// Morgan McGuire, morgan@cs.brown.edu
-int _kbhit() {
-    static const int STDIN = 0;
-    static bool initialized = false;
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
-    if (! initialized) {
-        // Use termios to turn off line buffering
-        struct termios term;
-        tcgetattr(STDIN, &term);
-        term.c_lflag &= ~ICANON;
-        tcsetattr(STDIN, TCSANOW, &term);
-        setbuf(stdin, NULL);
-        initialized = true;
-    }
-
-    int bytesWaiting;
-    ioctl(STDIN, FIONREAD, &bytesWaiting);
-    return bytesWaiting;
-}
-
-
-#define clear() printf("\033[H\033[J")
 #define green(text) "\x1B[32m" text "\x1B[0m"
 #define blue(text) "\x1B[34m" text "\x1B[0m"
 
 #define ArrayCount(arr) ((sizeof(arr))/sizeof(*arr))
 
+#include "bytecode.h"
+#include "checkpoint.h"
+#include "display.h"
+#include "flight_recorder.h"
+#include "input_acquisition.h"
+#include "input_source.h"
+#include "model_file.h"
+#include "output_sink.h"
+#include "process_image.h"
+#include "scheduler.h"
+#include "stretchy_buffer.h"
+#include "trace.h"
+#include "timer_wheel.h"
+#include "profiler.h"
+#include "worker_pool.h"
+
 #define STATE_OUTPUT_FUNCTION(Name) void Name()
 typedef STATE_OUTPUT_FUNCTION(state_output_function);
 
 #define TRANSITION_CONDITION_FUNCTION(Name) bool Name()
 typedef TRANSITION_CONDITION_FUNCTION(transition_condition_function);
 
+#define SCAN_FUNCTION(Name) void Name()
+typedef SCAN_FUNCTION(scan_function);
+
 #define ARR(...) {__VA_ARGS__}
 
-#include "preprocessor_output.h"
-
-// NOTE(nox): The ... in the macros are the place for the Output and Condition, respectively
-#define newState(Grafcet, Name_, ...)      \
-    do {                                                    \
-        state_id Id = State_X##Name_;                         \
-        Grafcets[Grafcet].States[Grafcets[Grafcet].StateCount++] = Id; \
-        strncpy(States[Id].Name, #Name_, NAME_LENGTH);             \
-        States[Id].Output = stateAction_X##Name_; \
-    } while(0)
-
-#define newTransition(Grafcet, Name_, PrevStates, NextStates_, ...)   \
-    do {                                                              \
-        transition_id Id = Transition_##Name_;                         \
-        state_id P[] = PrevStates;                                     \
-        state_id N[] = NextStates_;                                     \
-        Grafcets[Grafcet].Transitions[Grafcets[Grafcet].TransitionCount++] = Id; \
-        strncpy(Transitions[Id].Name, #Name_, NAME_LENGTH);             \
-        Transitions[Id].Condition = transitionCondition_##Name_;    \
-        Transitions[Id].PreviousStatesCount = ArrayCount(P); \
-        for(int I = 0; I < ArrayCount(P); ++I) { Transitions[Id].PreviousStates[I] = P[I]; } \
-        Transitions[Id].NextStatesCount = ArrayCount(N); \
-        for(int I = 0; I < ArrayCount(N); ++I) { Transitions[Id].NextStates[I] = N[I]; } \
-    } while(0)
-
-
-#define GRAFCET_COUNT 2
-#define GRAFCET_MAX_STATES 1024
-#define GRAFCET_MAX_TRANSITIONS 1024
-#define NAME_LENGTH 1<<4
+// NOTE(nox): The model and the header the preprocessor generated from it
+#if !defined(MODEL)
+#define MODEL "mixer.h"
+#endif
+#if !defined(GENERATED_HEADER)
+#define GENERATED_HEADER "preprocessor_output.h"
+#endif
 
-typedef struct {
-    bool Active;
-    char Name[NAME_LENGTH];
-    uint64_t Timer;
-    state_output_function *Output;
-} state;
+#include GENERATED_HEADER
+
+// NOTE(nox): The model is only read by the preprocessor, which turns it into the constant tables
+// and the functions of preprocessor_output.h, so nothing is built at startup. The ... in the
+// macros are the place for the Output and Condition, respectively.
+#define newState(Grafcet, Name, ...)
+#define newInitialState(Grafcet, Name, ...)
+#define newTransition(Grafcet, Name, PrevStates, NextStates, ...)
+#define grafcetPeriod(Grafcet, Milliseconds)
 
-typedef struct {
-    bool Active;
-    char Name[NAME_LENGTH];
-    int PreviousStatesCount;
-    state_id PreviousStates[GRAFCET_MAX_STATES];
-    int NextStatesCount;
-    state_id NextStates[GRAFCET_MAX_STATES];
-    transition_condition_function *Condition;
-} transition;
 
+// NOTE(nox): A grafcet owns the states [FirstState, FirstState + StateCount) and the
+// transitions [FirstTransition, FirstTransition + TransitionCount)
 typedef struct {
+    state_id FirstState;
     int StateCount;
-    state_id States[GRAFCET_MAX_STATES];
 
+    transition_id FirstTransition;
     int TransitionCount;
-    transition_id Transitions[GRAFCET_MAX_TRANSITIONS];
-
-    bool Frozen;
 } grafcet;
 
-static grafcet Grafcets[GRAFCET_COUNT];
-static state States[StateCount];
-static transition Transitions[TransitionCount];
+// NOTE(nox): Set of states given by the words [FirstWord, FirstWord + WordCount) of a bitset,
+// with the bits stored in StateMaskWords starting at Offset
+typedef struct {
+    uint32_t FirstWord;
+    uint32_t WordCount;
+    uint32_t Offset;
+} state_mask;
+
+// NOTE(nox): The transitions TransitionsTable[Offset .. Offset + Count) of a dependency table
+typedef struct {
+    uint32_t Offset;
+    uint32_t Count;
+} dependency_list;
+
+// NOTE(nox): Transition that must be tested Milliseconds after State (of Grafcet) activates
+typedef struct {
+    state_id State;
+    transition_id Transition;
+    int Grafcet;
+    uint32_t Milliseconds;
+} timer_threshold;
+
+// NOTE(nox): Bit (Id % 64) of word (Id / 64) is set when state Id is active. The initial
+// situation comes already set in the data segment.
+static uint64_t ActiveStates[StateWordCount] = INITIAL_ACTIVE_STATES;
+
+// NOTE(nox): Time of the current cycle and of the activation of every state, in nanoseconds
+// from the start; timer() gives the difference in milliseconds
+static uint64_t ScanTime;
+static uint64_t StateActivatedAt[StateCount];
+
+// NOTE(nox): Number of the current cycle, counted from 1 by beginCycle
+static uint64_t ScanTick;
+
+// NOTE(nox): Node N of the wheel of its state's grafcet belongs to TimerThresholds[N]
+static timer_node TimerNodes[TimerThresholdCount + 1];
+static timer_wheel TimerWheels[GrafcetCount];
+
+// NOTE(nox): Transitions to test on the next evaluation (all of them on the first one), and
+// the ones that fired on this one
+static uint64_t DirtyTransitions[TransitionWordCount] = DECLARED_TRANSITIONS;
+static uint64_t FiredTransitions[TransitionWordCount];
+
+// NOTE(nox): Supervision orders. freeze() holds a grafcet for the current cycle and suspend()
+// until resume(), which takes effect on the next cycle; a held grafcet keeps its situation and
+// its actions, and its timers keep running. reset() puts a grafcet back in its initial
+// situation when it is next scanned.
+static bool GrafcetFrozen[GrafcetCount];
+static bool GrafcetSuspended[GrafcetCount];
+static bool GrafcetResetPending[GrafcetCount];
+
+// NOTE(nox): The orders are not written there by the actions that give them: each grafcet queues
+// its own, marked in OrderingGrafcets, and they are carried out once the grafcets scanned
+// alongside it are done, in grafcet order, so a level scanned by several threads leaves the same
+// orders as the sequential scan.
+typedef enum {
+    Order_Freeze,
+    Order_Suspend,
+    Order_Resume,
+    Order_Reset,
+} order_type;
+
+typedef struct {
+    uint32_t Type;
+    uint32_t Grafcet;
+} grafcet_order;
+
+#define GrafcetWordCount ((GrafcetCount + 63)/64)
+static grafcet_order *GrafcetOrders[GrafcetCount];
+static uint64_t OrderingGrafcets[GrafcetWordCount];
+
+// NOTE(nox): Grafcet whose scan or actions this thread is running
+static _Thread_local int RunningGrafcet;
+
+// NOTE(nox): Cycle in which each grafcet was last scanned
+static uint64_t GrafcetScannedAt[GrafcetCount];
+
+#define isActive(Id) ((ActiveStates[(Id)/64] >> ((Id)%64)) & 1)
+#define markDirty(Id) (DirtyTransitions[(Id)/64] |= 1ull << ((Id)%64))
 
 // NOTE(nox): Inputs and Outputs
 #define ioEnumWriter(Name, ...) IO_##Name
 
 typedef struct {
     bool Active;
-    bool Modified;
+    uint64_t ChangedAt;
     char Name[25];
     char Key;
 } input;
 
-#define inputMacro(W) W(QUIT, 'q'), W(M_MAX, 'a'), W(M_MIN, 's'), W(PRATO1, 'd'), W(PRATO2, 'f'), \
-    W(PARAGEM, 'p'), W(CICLO, 'c')
+#include MODEL
 
-#define inputStructWriter(Name, Key) { false, false, #Name, Key }
+#define inputStructWriter(Name, Key) { false, 0, #Name, Key }
 static input Inputs[] = { inputMacro(inputStructWriter) };
 typedef enum { inputMacro(ioEnumWriter) } inputLabel;
 
 typedef struct {
-    bool Active;
     char Name[25];
 } output;
 
-#define outputStructWriter(Name) { false, #Name }
-#define outputMacro(W) W(ESQUERDA), W(BOMBA_V5), W(MOTOR_PA), W(V1), W(V2), W(V3), W(V4), W(V7)
-
+#define outputStructWriter(Name) { #Name }
 static output Outputs[] = { outputMacro(outputStructWriter) };
 typedef enum { outputMacro(ioEnumWriter) } outputLabel;
 
+// NOTE(nox): Output image, rebuilt every cycle by the actions, and the image of the previous
+// cycle; their XOR is what changed. Grafcets of the same level can set outputs of the same word
+// concurrently, so the bits are set with an atomic OR while the scan threads are running.
+enum { OutputWordCount = (ArrayCount(Outputs) + 63)/64 };
+static uint64_t OutputImage[OutputWordCount];
+static uint64_t PreviousOutputImage[OutputWordCount];
+static bool OutputsShared;
+
+#define outputActive(Index) ((OutputImage[(Index)/64] >> ((Index)%64)) & 1)
+
+static inline void setOutput(int Index) {
+    if(OutputsShared) {
+        __atomic_fetch_or(OutputImage + Index/64, 1ull << (Index%64), __ATOMIC_RELAXED);
+    } else {
+        OutputImage[Index/64] |= 1ull << (Index%64);
+    }
+}
+
+// NOTE(nox): Compressed sparse rows: the previous states of transition T are
+// TransitionLinks[TransitionLinkOffsets[2*T] .. TransitionLinkOffsets[2*T + 1]) and the next
+// states follow up to TransitionLinkOffsets[2*T + 2]
+#define TOPOLOGY
+#include GENERATED_HEADER
+#undef TOPOLOGY
+
+// NOTE(nox): The topology the engine runs: the tables compiled in, or the sections of a binary
+// model mapped with --model (model_file.h), used in place. CompiledBehaviour is false when the
+// conditions and actions of the model are not the compiled ones, which leaves the bytecode.
+typedef struct {
+    uint64_t TopologyHash;
+    bool CompiledBehaviour;
+    int GrafcetLevelCount;
+    const grafcet *Grafcets;
+    const int *GrafcetLevelOffsets;
+    const int *GrafcetsByLevel;
+    const uint32_t *GrafcetPeriods;
+    const uint32_t *TransitionLinkOffsets;
+    const state_id *TransitionLinks;
+    const state_mask *TransitionPreviousMasks;
+    const state_mask *TransitionNextMasks;
+    const uint64_t *StateMaskWords;
+    const timer_threshold *TimerThresholds;
+    const dependency_list *StateTimerThresholds;
+    const dependency_list *InputReaders;
+    const transition_id *InputReadersTransitions;
+    const dependency_list *StateWatchers;
+    const transition_id *StateWatchersTransitions;
+    const dependency_list *StateTimerReaders;
+    const transition_id *StateTimerReadersTransitions;
+    const uint64_t *TimedStates;
+    const uint64_t *VolatileTransitions;
+    const uint64_t *InitialStates;
+    const uint64_t *DeclaredTransitions;
+    const uint32_t *ConditionCode;
+    const uint32_t *ConditionOffsets;
+    const uint32_t *ActionCode;
+    const uint32_t *ActionOffsets;
+} model;
+
+static const uint64_t CompiledInitialStates[StateWordCount] = INITIAL_ACTIVE_STATES;
+static const uint64_t CompiledDeclaredTransitions[TransitionWordCount] = DECLARED_TRANSITIONS;
+
+static model Model = {
+    TOPOLOGY_HASH, true, GrafcetLevelCount, Grafcets, GrafcetLevelOffsets, GrafcetsByLevel, GrafcetPeriods,
+    TransitionLinkOffsets, TransitionLinks, TransitionPreviousMasks, TransitionNextMasks, StateMaskWords,
+    TimerThresholds, StateTimerThresholds, InputReaders, InputReadersTransitions, StateWatchers,
+    StateWatchersTransitions, StateTimerReaders, StateTimerReadersTransitions, TimedStates, VolatileTransitions,
+    CompiledInitialStates, CompiledDeclaredTransitions, ConditionCode, ConditionOffsets, ActionCode, ActionOffsets,
+};
+
+#define previousStatesBegin(Id) (Model.TransitionLinks + Model.TransitionLinkOffsets[2*(Id)])
+#define previousStatesEnd(Id) (Model.TransitionLinks + Model.TransitionLinkOffsets[2*(Id) + 1])
+#define nextStatesBegin(Id) previousStatesEnd(Id)
+#define nextStatesEnd(Id) (Model.TransitionLinks + Model.TransitionLinkOffsets[2*(Id) + 2])
+
+#define markDependents(Table, Key) markTransitions(Model.Table##Transitions, Model.Table[Key])
+
+static void markTransitions(const transition_id *Table, dependency_list List) {
+    for(uint32_t Index = 0; Index < List.Count; ++Index) {
+        markDirty(Table[List.Offset + Index]);
+    }
+}
+
+// NOTE(nox): An edge is seen by the first scan of each grafcet that comes after it; EdgesAfter
+// is the last cycle the grafcet being run by this thread was scanned in
+static _Thread_local uint64_t EdgesAfter;
+
 #define input(Label) Inputs[IO_##Label].Active
-#define RE(Label) (input(Label) && Inputs[IO_##Label].Modified)
-#define FE(Label) (!input(Label) && Inputs[IO_##Label].Modified)
-#define output(Label) Outputs[IO_##Label].Active = true
+#define RE(Label) (input(Label) && Inputs[IO_##Label].ChangedAt > EdgesAfter)
+#define FE(Label) (!input(Label) && Inputs[IO_##Label].ChangedAt > EdgesAfter)
+#define output(Label) setOutput(IO_##Label)
 
-#define freeze(Id) Grafcets[Id].Frozen = true
-#define active(Name) States[State_X##Name].Active
-#define timer(Name) States[State_X##Name].Timer
+static void giveOrder(order_type Type, int GrafcetId) {
+    if(!sb_count(GrafcetOrders[RunningGrafcet])) {
+        __atomic_fetch_or(OrderingGrafcets + RunningGrafcet/64, 1ull << (RunningGrafcet % 64), __ATOMIC_RELAXED);
+    }
+    sb_push(GrafcetOrders[RunningGrafcet], ((grafcet_order){Type, (uint32_t)GrafcetId}));
+}
+
+#define freeze(Id) giveOrder(Order_Freeze, Id)
+#define suspend(Id) giveOrder(Order_Suspend, Id)
+#define resume(Id) giveOrder(Order_Resume, Id)
+#define reset(Id) giveOrder(Order_Reset, Id)
+#define active(Name) isActive(State_X##Name)
+#define stateTimer(Id) ((ScanTime - StateActivatedAt[Id])/1000000)
+#define timer(Name) stateTimer(State_X##Name)
 
 #define OUTPUTS_AND_CONDITIONS
-#include "preprocessor_output.h"
+#include GENERATED_HEADER
 #undef OUTPUTS_AND_CONDITIONS
 
-static bool checkTransitionState(transition *Transition) {
-    bool AllPrevious = true;
-    for(int PrevIndex = 0; PrevIndex < Transition->PreviousStatesCount; ++PrevIndex) {
-        if(!States[Transition->PreviousStates[PrevIndex]].Active) {
-            AllPrevious = false;
-            break;
+#if defined(PROFILE)
+// NOTE(nox): Cost of every phase of the cycle (summed over grafcets), of every grafcet scan and
+// of every condition call. SIGUSR1 asks for a dump on stderr, which the scan thread writes at
+// the end of the cycle, so nothing is read while being updated.
+typedef enum {
+    Phase_OutputReset,
+    Phase_InputApply,
+    Phase_Timers,
+    Phase_Evaluation,
+    Phase_Deactivation,
+    Phase_Activation,
+    Phase_Outputs,
+    Phase_Display,
+
+    Phase_Count
+} scan_phase;
+
+static const char *PhaseNames[Phase_Count] = {
+    "output reset", "input apply", "timers", "evaluation", "deactivation", "activation", "outputs", "display",
+};
+
+static uint64_t PhaseTicks[Phase_Count];
+static histogram PhaseHistograms[Phase_Count];
+static histogram GrafcetHistograms[GrafcetCount];
+static call_counter ConditionCounters[TransitionCount];
+static volatile sig_atomic_t ProfileDumpRequested;
+
+#define profilePhase(Phase, Start) profileLap(PhaseTicks[Phase], Start)
+
+static void requestProfileDump(int Signal) {
+    ProfileDumpRequested = 1;
+}
+
+static void resetProfile() {
+    ticksPerNanosecond();
+    memset(PhaseTicks, 0, sizeof(PhaseTicks));
+    memset(PhaseHistograms, 0, sizeof(PhaseHistograms));
+    memset(GrafcetHistograms, 0, sizeof(GrafcetHistograms));
+    memset(ConditionCounters, 0, sizeof(ConditionCounters));
+}
+
+static void printHistogram(FILE *File, const char *Name, histogram *Histogram, double TicksPerNanosecond) {
+    if(Histogram->Count) {
+        fprintf(File, "%14s: %10llu samples, mean %9.0lf, p50 %9.0lf, p99 %9.0lf, max %9.0lf ns\n", Name,
+                (unsigned long long)Histogram->Count, (double)Histogram->Sum/Histogram->Count/TicksPerNanosecond,
+                histogramPercentile(Histogram, 50)/TicksPerNanosecond,
+                histogramPercentile(Histogram, 99)/TicksPerNanosecond, Histogram->Max/TicksPerNanosecond);
+    }
+}
+
+static int compareConditionCost(const void *A, const void *B) {
+    uint64_t CostA = ConditionCounters[*(const transition_id *)A].Ticks;
+    uint64_t CostB = ConditionCounters[*(const transition_id *)B].Ticks;
+    return (CostA < CostB) - (CostA > CostB);
+}
+
+#define PROFILE_DUMPED_CONDITIONS 32
+
+static void dumpProfile(FILE *File) {
+    double TicksPerNanosecond = ticksPerNanosecond();
+    fprintf(File, "Cycle phases:\n");
+    for(int Phase = 0; Phase < Phase_Count; ++Phase) {
+        printHistogram(File, PhaseNames[Phase], PhaseHistograms + Phase, TicksPerNanosecond);
+    }
+
+    fprintf(File, "Grafcet scans:\n");
+    for(int GrafcetId = 0; GrafcetId < GrafcetCount; ++GrafcetId) {
+        char Name[32];
+        snprintf(Name, sizeof(Name), "grafcet %d", GrafcetId);
+        printHistogram(File, Name, GrafcetHistograms + GrafcetId, TicksPerNanosecond);
+    }
+
+    static transition_id Order[TransitionCount];
+    int Called = 0;
+    for(transition_id Id = 0; Id < TransitionCount; ++Id) {
+        if(ConditionCounters[Id].Calls) {
+            Order[Called++] = Id;
         }
     }
-    if(AllPrevious) {
-        return Transition->Condition();
+    qsort(Order, Called, sizeof(*Order), compareConditionCost);
+    fprintf(File, "Most expensive conditions (%d called):\n", Called);
+    for(int Index = 0; Index < Called && Index < PROFILE_DUMPED_CONDITIONS; ++Index) {
+        call_counter *Counter = ConditionCounters + Order[Index];
+        fprintf(File, "%14s: %10llu calls, %12.0lf ns total, %7.1lf ns/call\n", TransitionNames[Order[Index]],
+                (unsigned long long)Counter->Calls, Counter->Ticks/TicksPerNanosecond,
+                Counter->Ticks/TicksPerNanosecond/Counter->Calls);
     }
+    fflush(File);
+}
 
-    return false;
+static void endProfiledCycle() {
+    for(int Phase = 0; Phase < Phase_Count; ++Phase) {
+        if(PhaseTicks[Phase]) {
+            histogramRecord(PhaseHistograms + Phase, PhaseTicks[Phase]);
+            PhaseTicks[Phase] = 0;
+        }
+    }
+    if(ProfileDumpRequested) {
+        ProfileDumpRequested = 0;
+        dumpProfile(stderr);
+    }
 }
+#else
+#define profilePhase(Phase, Start)
+#define endProfiledCycle()
+#endif
 
-int main(int Argc, char *Argv[]) {
-    // NOTE(nox): Control Grafcet
-    newState(1, 1, {});
-    States[State_X1].Active = true;
-    newTransition(1, 1, ARR(State_X1), ARR(State_X2, State_X4, State_X6), (input(CICLO)));
+// NOTE(nox): Flight recorder: every step change, firing, freeze and output change of the engine
+// goes to the ring of flight_recorder.h. It is dumped on SIGUSR2 (at the end of the cycle), on a
+// crash (from the signal handler) and with dumpFlightRecorder; flight_decoder.out prints it.
+static flight_recorder FlightRecorder;
+static flight_recorder_header FlightHeader;
+static const char *FlightRecorderPath = "flight_recorder.bin";
+static volatile sig_atomic_t FlightDumpRequested;
+static bool RecordedFrozen[GrafcetCount];
 
-    newState(1, 2, { output(V1); });
-    newState(1, 3, {});
-    newTransition(1, 2, ARR(State_X2), ARR(State_X3), (input(PRATO1)));
+#define flightEvent(Kind, Id) recordEvent(&FlightRecorder, Kind, Id, ScanTime)
 
-    newState(1, 4, { output(V3); });
-    newState(1, 5, {});
-    newTransition(1, 3, ARR(State_X4), ARR(State_X5), (input(PRATO2)));
+static void requestFlightDump(int Signal) {
+    FlightDumpRequested = 1;
+}
 
-    newState(1, 6, { if(!input(M_MAX)) output(BOMBA_V5); });
-    newTransition(1, 4, ARR(State_X3, State_X5, State_X6), ARR(State_X7), (input(M_MAX)));
+static void dumpFlightRecorderOnCrash(int Signal) {
+    dumpFlightRecorder(&FlightRecorder, FlightHeader, FlightRecorderPath);
+    signal(Signal, SIG_DFL);
+    raise(Signal);
+}
 
-    newState(1, 7, { output(ESQUERDA); output(MOTOR_PA); output(V2); output(V4);  });
-    newTransition(1, 5, ARR(State_X7), ARR(State_X8), (timer(7)>=30));
+static void startFlightRecorder() {
+    FlightHeader.StateCount = StateCount;
+    FlightHeader.TransitionCount = TransitionCount;
+    FlightHeader.GrafcetCount = GrafcetCount;
+    FlightHeader.OutputCount = ArrayCount(Outputs);
+    signal(SIGUSR2, requestFlightDump);
+    int CrashSignals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+    for(int Index = 0; Index < ArrayCount(CrashSignals); ++Index) {
+        signal(CrashSignals[Index], dumpFlightRecorderOnCrash);
+    }
+}
 
-    newState(1, 8, { output(ESQUERDA); output(MOTOR_PA); });
-    newTransition(1, 6, ARR(State_X8), ARR(State_X9), (timer(8)>=40));
+static void endFlightRecorderCycle() {
+    if(FlightDumpRequested) {
+        FlightDumpRequested = 0;
+        if(!dumpFlightRecorder(&FlightRecorder, FlightHeader, FlightRecorderPath)) {
+            fprintf(stderr, "Could not write the flight recorder to %s\n", FlightRecorderPath);
+        }
+    }
+}
 
-    newState(1, 9, { output(V7); });
-    newTransition(1, 7, ARR(State_X9), ARR(State_X1), (input(M_MIN)));
+// NOTE(nox): True when every state in the mask is active; wide synchronizations are tested
+// several words at a time
+static inline bool allStatesActive(state_mask Mask) {
+    const uint64_t *Active = ActiveStates + Mask.FirstWord;
+    const uint64_t *Bits = Model.StateMaskWords + Mask.Offset;
+    uint32_t Index = 0;
+#if defined(__AVX2__)
+    for(; Index + 4 <= Mask.WordCount; Index += 4) {
+        __m256i A = _mm256_loadu_si256((const __m256i *)(Active + Index));
+        __m256i M = _mm256_loadu_si256((const __m256i *)(Bits + Index));
+        if(!_mm256_testc_si256(A, M)) {
+            return false;
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    for(; Index + 2 <= Mask.WordCount; Index += 2) {
+        __m128i A = _mm_loadu_si128((const __m128i *)(Active + Index));
+        __m128i M = _mm_loadu_si128((const __m128i *)(Bits + Index));
+        __m128i Missing = _mm_andnot_si128(A, M);
+        if(_mm_movemask_epi8(_mm_cmpeq_epi8(Missing, _mm_setzero_si128())) != 0xFFFF) {
+            return false;
+        }
+    }
+#endif
+    for(; Index < Mask.WordCount; ++Index) {
+        if((Active[Index] & Bits[Index]) != Bits[Index]) {
+            return false;
+        }
+    }
 
+    return true;
+}
 
-    // NOTE(nox): Supervisor Grafcet
-    newState(0, s1, {});
-    States[State_Xs1].Active = true;
-    newTransition(0, s1, ARR(State_Xs1), ARR(State_Xs2), ((active(2) || active(4) || active(6) || active(7)) &&
-                                                          RE(PARAGEM)));
-    newState(0, s2, { freeze(1); });
-    newTransition(0, s2, ARR(State_Xs2), ARR(State_Xs1), (!input(PARAGEM)));
+static bool checkTransitionState(transition_id Id) {
+    if(allStatesActive(Model.TransitionPreviousMasks[Id])) {
+        profileStart(Start);
+        bool Result = TransitionConditions[Id]();
+        profileCount(ConditionCounters[Id], Start);
+        return Result;
+    }
 
+    return false;
+}
 
-    // NOTE(nox): Generic grafcet logic ----------------------------------------
-    for(;;) {
-        if(input(QUIT)) {
+static void toggleInput(int Index) {
+    Inputs[Index].Active = !Inputs[Index].Active;
+    Inputs[Index].ChangedAt = ScanTick;
+    markDependents(InputReaders, Index);
+}
+
+// NOTE(nox): Edges are applied at the start of the cycle in arrival order and at most one per
+// input and cycle: the first edge of an input already changed in this cycle, and everything
+// queued after it, waits for the next cycle. An edge for an input the model does not have is
+// consumed and counted as dropped, so it can never hold the ring up. InputQueue is filled by the
+// acquisition thread and ProcessQueue by the scan thread itself from the process image, each the
+// only producer of its ring.
+static input_queue InputQueue;
+static input_queue ProcessQueue;
+
+static void applyInputEdges(input_queue *Queue) {
+    uint32_t Depth = inputQueueDepth(Queue);
+    if(Depth > Queue->MaxDepth) {
+        Queue->MaxDepth = Depth;
+    }
+    for(const input_edge *Edge; (Edge = peekInputEdge(Queue)); popInputEdge(Queue)) {
+        if(Edge->Input >= ArrayCount(Inputs)) {
+            atomic_fetch_add_explicit(&Queue->Dropped, 1, memory_order_relaxed);
+            continue;
+        }
+        if(Inputs[Edge->Input].ChangedAt == ScanTick) {
             break;
         }
+        bool Value = Edge->Kind == Edge_Toggle ? !Inputs[Edge->Input].Active : Edge->Kind == Edge_Rise;
+        if(Value != Inputs[Edge->Input].Active) {
+            toggleInput(Edge->Input);
+        }
+    }
+}
 
-        // NOTE(nox): Reset outputs and inputs modification flag
-        for(int Index = 0; Index < ArrayCount(Outputs); ++Index) {
-            Outputs[Index].Active = false;
+// NOTE(nox): Inputs of the shared process image (--shm) become edges like the ones of any other
+// source; an image a client is writing is left for the next cycle
+static process_image *ProcessImage;
+static uint64_t ProcessInputs[(ArrayCount(Inputs) + 63)/64];
+
+static void readProcessImage(uint64_t Time) {
+    uint64_t Read[ArrayCount(ProcessInputs)];
+    if(!readProcessInputs(ProcessImage, Read, ArrayCount(Inputs))) {
+        return;
+    }
+    for(int Word = 0; Word < ArrayCount(ProcessInputs); ++Word) {
+        for(uint64_t Changed = Read[Word] ^ ProcessInputs[Word]; Changed; Changed &= Changed - 1) {
+            int Bit = __builtin_ctzll(Changed);
+            pushInputEdge(&ProcessQueue, Time, 64*Word + Bit, (Read[Word] >> Bit) & 1 ? Edge_Rise : Edge_Fall);
         }
-        for(int Index = 0; Index < ArrayCount(Inputs); ++Index) {
-            Inputs[Index].Modified = false;
+        ProcessInputs[Word] = Read[Word];
+    }
+}
+
+// NOTE(nox): Reset outputs; the input edges of the previous cycles are told apart by ChangedAt
+static void beginCycle() {
+    memset(OutputImage, 0, sizeof(OutputImage));
+    ++ScanTick;
+}
+
+#define millisecondsFromNanoseconds(Time) ((Time)/1000000)
+
+// NOTE(nox): The wheel tick is a millisecond, but timer() counts from the exact activation time.
+// A threshold is woken on the tick its deadline falls in; if that cycle still comes before the
+// deadline, the threshold waits in PendingThresholds and is checked every cycle until timer()
+// reaches it or its state is left. Its transition is thus tested in the first cycle in which
+// timer() >= threshold holds, whatever the period and the phase of the activation. Only the
+// advance of the wheels, on the scan thread, can wake a threshold early: one started during a
+// scan is either due already or at least a tick away.
+static uint32_t PendingThresholds[TimerThresholdCount + 1];
+static bool ThresholdPending[TimerThresholdCount + 1];
+static int PendingThresholdCount;
+
+static bool thresholdDue(uint32_t Node) {
+    const timer_threshold *Threshold = Model.TimerThresholds + Node;
+    return ScanTime - StateActivatedAt[Threshold->State] >= Threshold->Milliseconds*1000000ull;
+}
+
+static TIMER_EXPIRED(thresholdReached) {
+    if(thresholdDue(Node)) {
+        markDirty(Model.TimerThresholds[Node].Transition);
+    } else if(!ThresholdPending[Node]) {
+        ThresholdPending[Node] = true;
+        PendingThresholds[PendingThresholdCount++] = Node;
+    }
+}
+
+static void startStateTimers(state_id Id) {
+    dependency_list List = Model.StateTimerThresholds[Id];
+    for(uint32_t Node = List.Offset; Node < List.Offset + List.Count; ++Node) {
+        const timer_threshold *Threshold = Model.TimerThresholds + Node;
+        uint64_t Expiry = millisecondsFromNanoseconds(StateActivatedAt[Id] + Threshold->Milliseconds*1000000ull);
+        startTimer(TimerWheels + Threshold->Grafcet, TimerNodes, Node, Expiry, thresholdReached);
+    }
+}
+
+static void stopStateTimers(state_id Id) {
+    dependency_list List = Model.StateTimerThresholds[Id];
+    for(uint32_t Node = List.Offset; Node < List.Offset + List.Count; ++Node) {
+        unlinkTimer(TimerWheels + Model.TimerThresholds[Node].Grafcet, TimerNodes, Node);
+    }
+}
+
+// NOTE(nox): Bookkeeping of a step change, shared by every path that changes steps (the generic
+// and the generated scans, and resets): timers, the transitions that watch the step and the
+// flight recorder.
+static inline void leaveStep(state_id Id) {
+    flightEvent(Event_StepDeactivated, Id);
+    stopStateTimers(Id);
+    markDependents(StateWatchers, Id);
+}
+
+static inline void enterStep(state_id Id) {
+    flightEvent(Event_StepActivated, Id);
+    StateActivatedAt[Id] = ScanTime;
+    startStateTimers(Id);
+    markDependents(StateWatchers, Id);
+}
+
+// NOTE(nox): A reset is applied by the thread that scans the grafcet, before the scan, like a
+// firing that leaves every step outside the initial situation and enters every initial step
+// that is not active: the grafcet's words are swapped for the initial ones and only the steps
+// that change are visited, so a reset costs the words of the grafcet plus its changes, never a
+// walk over all its steps.
+static void applyGrafcetReset(int GrafcetId) {
+    const uint64_t *InitialActive = Model.InitialStates;
+    const grafcet *Grafcet = Model.Grafcets + GrafcetId;
+    GrafcetResetPending[GrafcetId] = false;
+    flightEvent(Event_GrafcetReset, GrafcetId);
+    for(int Word = Grafcet->FirstState/64; Word < (Grafcet->FirstState + Grafcet->StateCount + 63)/64; ++Word) {
+        uint64_t Left = ActiveStates[Word] & ~InitialActive[Word];
+        uint64_t Entered = InitialActive[Word] & ~ActiveStates[Word];
+        ActiveStates[Word] = InitialActive[Word];
+        for(; Left; Left &= Left - 1) {
+            leaveStep(64*Word + __builtin_ctzll(Left));
         }
+        for(; Entered; Entered &= Entered - 1) {
+            enterStep(64*Word + __builtin_ctzll(Entered));
+        }
+    }
+}
 
-        // NOTE(nox): Read inputs
-        while(_kbhit()) {
-            char C = getchar();
-            for(int Index = 0; Index < ArrayCount(Inputs); ++Index) {
-                if(Inputs[Index].Key == C) {
-                    Inputs[Index].Active = !Inputs[Index].Active;
-                    Inputs[Index].Modified = true;
-                    break;
+static void applyGrafcetOrders() {
+    for(int Word = 0; Word < GrafcetWordCount; ++Word) {
+        for(uint64_t Bits = OrderingGrafcets[Word]; Bits; Bits &= Bits - 1) {
+            grafcet_order *Orders = GrafcetOrders[64*Word + __builtin_ctzll(Bits)];
+            for(int Index = 0; Index < sb_count(Orders); ++Index) {
+                uint32_t Id = Orders[Index].Grafcet;
+                switch(Orders[Index].Type) {
+                    case Order_Freeze: { GrafcetFrozen[Id] = true; } break;
+                    case Order_Suspend: { GrafcetSuspended[Id] = GrafcetFrozen[Id] = true; } break;
+                    case Order_Resume: { GrafcetSuspended[Id] = false; } break;
+                    case Order_Reset: { GrafcetResetPending[Id] = true; } break;
                 }
             }
+            stb__sbn(Orders) = 0;
+        }
+        OrderingGrafcets[Word] = 0;
+    }
+}
+
+// NOTE(nox): End of cycle: freezes last one cycle, suspensions until resume()
+static void releaseGrafcets() {
+    memcpy(GrafcetFrozen, GrafcetSuspended, sizeof(GrafcetFrozen));
+}
+
+static void resetTimers(uint64_t Now) {
+    memset(TimerNodes, 0, sizeof(TimerNodes));
+    for(int GrafcetId = 0; GrafcetId < GrafcetCount; ++GrafcetId) {
+        initTimerWheel(TimerWheels + GrafcetId, Now);
+    }
+    memset(ThresholdPending, 0, sizeof(ThresholdPending));
+    PendingThresholdCount = 0;
+}
+
+// NOTE(nox): Schedules the thresholds of the initial situation
+static void startTimers() {
+    for(int Word = 0; Word < StateWordCount; ++Word) {
+        for(uint64_t Bits = ActiveStates[Word]; Bits; Bits &= Bits - 1) {
+            startStateTimers(64*Word + __builtin_ctzll(Bits));
+        }
+    }
+}
+
+// NOTE(nox): Thresholds are woken by the timer wheels; conditions that use timers in any other
+// way are tested every cycle while their state is active
+static void updateTimers() {
+    for(int Index = 0; Index < PendingThresholdCount;) {
+        uint32_t Node = PendingThresholds[Index];
+        const timer_threshold *Threshold = Model.TimerThresholds + Node;
+        bool Active = isActive(Threshold->State);
+        if(Active && !thresholdDue(Node)) {
+            ++Index;
+            continue;
+        }
+        if(Active) {
+            markDirty(Threshold->Transition);
         }
+        ThresholdPending[Node] = false;
+        PendingThresholds[Index] = PendingThresholds[--PendingThresholdCount];
+    }
+    for(int GrafcetId = 0; GrafcetId < GrafcetCount; ++GrafcetId) {
+        advanceTimerWheel(TimerWheels + GrafcetId, TimerNodes, millisecondsFromNanoseconds(ScanTime),
+                          thresholdReached);
+    }
+    for(int Word = 0; Word < StateWordCount; ++Word) {
+        for(uint64_t Bits = ActiveStates[Word] & Model.TimedStates[Word]; Bits; Bits &= Bits - 1) {
+            markDependents(StateTimerReaders, 64*Word + __builtin_ctzll(Bits));
+        }
+    }
+    for(int Word = 0; Word < TransitionWordCount; ++Word) {
+        DirtyTransitions[Word] |= Model.VolatileTransitions[Word];
+    }
+}
 
-        // NOTE(nox): Update timers
-        for(int Index = 0; Index < StateCount; ++Index) {
-            state *State = States + Index;
-            if(State->Active) {
-                ++State->Timer;
+#include "interpreter.h"
+
+// NOTE(nox): Tests the dirty transitions of the words [FirstWord, EndWord) into FiredTransitions.
+// This only reads the situation, so words can be evaluated concurrently.
+static void evaluateTransitionWords(int FirstWord, int EndWord) {
+    if(UseBytecode) {
+        evaluateTransitionCode(FirstWord, EndWord);
+        return;
+    }
+    for(int Word = FirstWord; Word < EndWord; ++Word) {
+        uint64_t Fired = 0;
+        for(uint64_t Bits = DirtyTransitions[Word]; Bits; Bits &= Bits - 1) {
+            int Bit = __builtin_ctzll(Bits);
+            if(checkTransitionState(64*Word + Bit)) {
+                Fired |= 1ull << Bit;
             }
         }
+        DirtyTransitions[Word] = 0;
+        FiredTransitions[Word] = Fired;
+    }
+}
+
+// NOTE(nox): A grafcet with enough dirty transitions has them evaluated by all the scan threads,
+// in chunks of EVALUATION_CHUNK_WORDS words handed out by work stealing; smaller ones, or the
+// ones scanned from inside a pool job, are evaluated right here without any synchronization
+#define PARALLEL_EVALUATION_MIN_DIRTY 1024
+#define EVALUATION_CHUNK_WORDS 2
+
+static worker_pool ScanPool;
+static bool ScanPoolBusy;
+static pool_share EvaluationShares[POOL_MAX_THREADS];
+
+typedef struct {
+    int FirstWord;
+    int EndWord;
+    uint64_t EdgesAfter;
+} evaluation_job;
+
+static POOL_JOB(evaluateChunks) {
+    evaluation_job *Job = (evaluation_job *)Data;
+    EdgesAfter = Job->EdgesAfter;
+    uint32_t Chunk;
+    while(nextPoolItem(&ScanPool, EvaluationShares, Thread, &Chunk)) {
+        int FirstWord = Job->FirstWord + Chunk*EVALUATION_CHUNK_WORDS;
+        int EndWord = FirstWord + EVALUATION_CHUNK_WORDS < Job->EndWord ? FirstWord + EVALUATION_CHUNK_WORDS : Job->EndWord;
+        evaluateTransitionWords(FirstWord, EndWord);
+    }
+}
+
+static void evaluateTransitions(int FirstWord, int EndWord) {
+    if(ScanPool.ThreadCount > 1 && !ScanPoolBusy) {
+        int Dirty = 0;
+        for(int Word = FirstWord; Word < EndWord; ++Word) {
+            Dirty += __builtin_popcountll(DirtyTransitions[Word]);
+        }
+        if(Dirty >= PARALLEL_EVALUATION_MIN_DIRTY) {
+            evaluation_job Job = {FirstWord, EndWord, EdgesAfter};
+            sharePoolItems(&ScanPool, EvaluationShares,
+                           (EndWord - FirstWord + EVALUATION_CHUNK_WORDS - 1)/EVALUATION_CHUNK_WORDS);
+            runPoolJob(&ScanPool, evaluateChunks, &Job);
+            return;
+        }
+    }
+    evaluateTransitionWords(FirstWord, EndWord);
+}
 
-        clear();
-        for(int GrafcetId = 0; GrafcetId < GRAFCET_COUNT; ++GrafcetId) {
-            grafcet *Grafcet = Grafcets + GrafcetId;
-            // NOTE(nox): Calculate transitions
-            for(int Index = 0; Index < Grafcet->TransitionCount; ++Index) {
-                transition *Transition = Transitions + Grafcet->Transitions[Index];
-                Transition->Active = Grafcet->Frozen ? false : checkTransitionState(Transition);
+// NOTE(nox): The outputs phase of scanGrafcet alone, for the cycles a grafcet is not scanned in
+static void runStateActions(int GrafcetId) {
+    const grafcet *Grafcet = Model.Grafcets + GrafcetId;
+    int FirstWord = Grafcet->FirstState/64;
+    int EndWord = (Grafcet->FirstState + Grafcet->StateCount + 63)/64;
+    if(UseBytecode) {
+        runStateActionCode(FirstWord, EndWord);
+    } else {
+        for(int Word = FirstWord; Word < EndWord; ++Word) {
+            for(uint64_t Bits = ActiveStates[Word]; Bits; Bits &= Bits - 1) {
+                StateOutputs[64*Word + __builtin_ctzll(Bits)]();
             }
+        }
+    }
+}
 
-            // NOTE(nox): Deactivate above
-            for(int Index = 0; Index < Grafcet->TransitionCount; ++Index) {
-                transition *Transition = Transitions + Grafcet->Transitions[Index];
-                if(Transition->Active) {
-                    for(int PrevIndex = 0; PrevIndex < Transition->PreviousStatesCount; ++PrevIndex) {
-                        States[Transition->PreviousStates[PrevIndex]].Active = false;
-                    }
-                }
+static void scanGrafcet(int GrafcetId) {
+    const grafcet *Grafcet = Model.Grafcets + GrafcetId;
+    int FirstWord = Grafcet->FirstTransition/64;
+    int EndWord = FirstWord + (Grafcet->TransitionCount + 63)/64;
+    state_id FirstState = Grafcet->FirstState;
+    state_id EndState = FirstState + Grafcet->StateCount;
+    profileStart(Start);
+
+    // NOTE(nox): Calculate transitions; only the ones marked dirty by an input edge, a timer or a
+    // change of the states they depend on can have become fireable. While frozen the marks are
+    // kept for when the grafcet is released.
+    if(GrafcetFrozen[GrafcetId]) {
+        memset(FiredTransitions + FirstWord, 0, (EndWord - FirstWord)*sizeof(*FiredTransitions));
+    } else {
+        evaluateTransitions(FirstWord, EndWord);
+    }
+    profilePhase(Phase_Evaluation, Start);
+
+    // NOTE(nox): Deactivate above
+    for(int Word = FirstWord; Word < EndWord; ++Word) {
+        for(uint64_t Bits = FiredTransitions[Word]; Bits; Bits &= Bits - 1) {
+            transition_id Id = 64*Word + __builtin_ctzll(Bits);
+            state_mask Mask = Model.TransitionPreviousMasks[Id];
+            flightEvent(Event_TransitionFired, Id);
+            for(uint32_t Index = 0; Index < Mask.WordCount; ++Index) {
+                ActiveStates[Mask.FirstWord + Index] &= ~Model.StateMaskWords[Mask.Offset + Index];
+            }
+            for(const state_id *Prev = previousStatesBegin(Id); Prev != previousStatesEnd(Id); ++Prev) {
+                leaveStep(*Prev);
             }
+        }
+    }
+    profilePhase(Phase_Deactivation, Start);
 
-            // NOTE(nox): Activate below
-            for(int Index = 0; Index < Grafcet->TransitionCount; ++Index) {
-                transition *Transition = Transitions + Grafcet->Transitions[Index];
-                if(Transition->Active) {
-                    for(int NextIndex = 0; NextIndex < Transition->NextStatesCount; ++NextIndex) {
-                        States[Transition->NextStates[NextIndex]].Active = true;
-                        States[Transition->NextStates[NextIndex]].Timer = 0;
-                    }
-                }
+    // NOTE(nox): Activate below
+    for(int Word = FirstWord; Word < EndWord; ++Word) {
+        for(uint64_t Bits = FiredTransitions[Word]; Bits; Bits &= Bits - 1) {
+            transition_id Id = 64*Word + __builtin_ctzll(Bits);
+            state_mask Mask = Model.TransitionNextMasks[Id];
+            for(uint32_t Index = 0; Index < Mask.WordCount; ++Index) {
+                ActiveStates[Mask.FirstWord + Index] |= Model.StateMaskWords[Mask.Offset + Index];
+            }
+            for(const state_id *Next = nextStatesBegin(Id); Next != nextStatesEnd(Id); ++Next) {
+                enterStep(*Next);
             }
+        }
+    }
+    profilePhase(Phase_Activation, Start);
 
-            // NOTE(nox): Outputs
-            for(int Index = 0; Index < Grafcet->StateCount; ++Index) {
-                state *State = States + Grafcet->States[Index];
-                if(State->Active) {
-                    State->Output();
-                }
+    // NOTE(nox): Outputs; a grafcet starts on a word boundary and its padding states are never
+    // active, so only the set bits of its words are visited
+    if(UseBytecode) {
+        runStateActionCode(FirstState/64, (EndState + 63)/64);
+    } else {
+        for(int Word = FirstState/64; Word < (EndState + 63)/64; ++Word) {
+            for(uint64_t Bits = ActiveStates[Word]; Bits; Bits &= Bits - 1) {
+                StateOutputs[64*Word + __builtin_ctzll(Bits)]();
             }
+        }
+    }
+    profilePhase(Phase_Outputs, Start);
+}
 
-            // NOTE(nox): Print debug information
-            printf("Grafcet %d %s\n", GrafcetId, Grafcet->Frozen ? blue("FROZEN") : "");
-            for(int Index = 0; Index < Grafcet->StateCount; ++Index) {
-                if(States[Grafcet->States[Index]].Active) {
-                    printf("%5s: " green("Active") " %.1lfs\n", States[Grafcet->States[Index]].Name,
-                           (double)States[Grafcet->States[Index]].Timer/10);
-                } else {
-                    printf("%5s: Inactive\n", States[Grafcet->States[Index]].Name);
-                }
+#define SCAN_FUNCTIONS
+#include GENERATED_HEADER
+#undef SCAN_FUNCTIONS
+
+// NOTE(nox): Scan rates: a grafcet declared with grafcetPeriod(Grafcet, Milliseconds) is scanned
+// on one cycle out of GrafcetDivisors[Id], starting with the first, the period being rounded to
+// whole cycles of the scheduler; the others are scanned every cycle. On the cycles in between
+// nothing of it is evaluated, only the actions of its active steps run again, since the output
+// image is rebuilt every cycle. Its edges, timer expirations and dirty transitions wait for its
+// next scan. Grafcets due in the same cycle keep the order of the levels.
+static uint32_t GrafcetDivisors[GrafcetCount];
+
+#define grafcetDue(Id, Tick) (GrafcetDivisors[Id] <= 1 || ((Tick) - 1) % GrafcetDivisors[Id] == 0)
+
+// NOTE(nox): False when a period is not a whole number of cycles
+static bool setScanRates(uint64_t Period) {
+    bool Exact = true;
+    for(int GrafcetId = 0; GrafcetId < GrafcetCount; ++GrafcetId) {
+        uint64_t Nanoseconds = Model.GrafcetPeriods[GrafcetId]*1000000ull;
+        uint64_t Divisor = (Nanoseconds + Period/2)/Period;
+        GrafcetDivisors[GrafcetId] = Divisor < 1 ? 1 : Divisor > UINT32_MAX ? UINT32_MAX : (uint32_t)Divisor;
+        Exact = Exact && (!Nanoseconds || Nanoseconds == GrafcetDivisors[GrafcetId]*Period);
+    }
+    return Exact;
+}
+
+// NOTE(nox): Runs a grafcet either through the generic tables or through the straight-line
+// function generated with preprocessor.out --scan-functions
+static bool UseGeneratedScans = false;
+
+// NOTE(nox): Freezes are recorded when they start and end rather than every cycle
+static void runGrafcet(int GrafcetId) {
+    RunningGrafcet = GrafcetId;
+    EdgesAfter = GrafcetScannedAt[GrafcetId];
+    if(!grafcetDue(GrafcetId, ScanTick)) {
+        runStateActions(GrafcetId);
+        return;
+    }
+    GrafcetScannedAt[GrafcetId] = ScanTick;
+
+    profileStart(Start);
+    if(GrafcetResetPending[GrafcetId]) {
+        applyGrafcetReset(GrafcetId);
+    }
+    if(GrafcetFrozen[GrafcetId] != RecordedFrozen[GrafcetId]) {
+        RecordedFrozen[GrafcetId] = GrafcetFrozen[GrafcetId];
+        flightEvent(GrafcetFrozen[GrafcetId] ? Event_GrafcetFrozen : Event_GrafcetReleased, GrafcetId);
+    }
+#if defined(GENERATED_SCAN_FUNCTIONS)
+    if(UseGeneratedScans) {
+        GeneratedScans[GrafcetId]();
+    } else
+#endif
+    {
+        scanGrafcet(GrafcetId);
+    }
+    profileRecord(GrafcetHistograms + GrafcetId, Start);
+}
+
+// NOTE(nox): With more than one scan thread, each hierarchy level is shared out between the
+// threads (a grafcet at a time, from a shared cursor) and the end of the job separates the
+// levels. A level of a single grafcet is scanned by this thread, leaving the pool free to
+// evaluate its transitions.
+static _Atomic int LevelCursor;
+
+static POOL_JOB(scanLevel) {
+    int End = Model.GrafcetLevelOffsets[*(int *)Data + 1];
+    for(;;) {
+        int Index = atomic_fetch_add_explicit(&LevelCursor, 1, memory_order_relaxed);
+        if(Index >= End) {
+            break;
+        }
+        runGrafcet(Model.GrafcetsByLevel[Index]);
+    }
+}
+
+// NOTE(nox): An output is the OR of the actions of every active step, so changes are only known
+// once all the grafcets are scanned
+static output_sinks OutputSinks;
+
+static void publishOutputs() {
+    output_change Changes[ArrayCount(Outputs)];
+    int Count = 0;
+    for(int Word = 0; Word < OutputWordCount; ++Word) {
+        for(uint64_t Changed = OutputImage[Word] ^ PreviousOutputImage[Word]; Changed; Changed &= Changed - 1) {
+            int Index = 64*Word + __builtin_ctzll(Changed);
+            bool Value = outputActive(Index);
+            flightEvent(Value ? Event_OutputOn : Event_OutputOff, Index);
+            Changes[Count++] = (output_change){ScanTime, (uint32_t)Index, Value};
+        }
+        PreviousOutputImage[Word] = OutputImage[Word];
+    }
+    if(Count) {
+        dispatchOutputChanges(&OutputSinks, Changes, Count);
+    }
+}
+
+static void scanGrafcets() {
+    if(ScanPool.ThreadCount > 1) {
+        for(int Level = 0; Level < Model.GrafcetLevelCount; ++Level) {
+            int Begin = Model.GrafcetLevelOffsets[Level];
+            if(Model.GrafcetLevelOffsets[Level + 1] - Begin == 1) {
+                runGrafcet(Model.GrafcetsByLevel[Begin]);
+            } else {
+                atomic_store_explicit(&LevelCursor, Begin, memory_order_relaxed);
+                ScanPoolBusy = true;
+                runPoolJob(&ScanPool, scanLevel, &Level);
+                ScanPoolBusy = false;
+            }
+            applyGrafcetOrders();
+        }
+    } else {
+        for(int GrafcetId = 0; GrafcetId < GrafcetCount; ++GrafcetId) {
+            runGrafcet(GrafcetId);
+            applyGrafcetOrders();
+        }
+    }
+    publishOutputs();
+}
+
+// NOTE(nox): Debug display ---------------------------------------------------
+// The scan thread publishes a snapshot of the engine at the end of every cycle and a renderer
+// thread draws it at its own rate, so console speed never affects the scan period. Snapshots
+// are double-buffered, each buffer guarded by a sequence number (odd while being written): the
+// scan thread never waits, it writes the buffer not published last, and the renderer retries
+// if the buffer it copied was rewritten meanwhile.
+typedef struct {
+    uint64_t ScanTime;
+    uint64_t ActiveStates[StateWordCount];
+    uint64_t StateActivatedAt[StateCount];
+    bool GrafcetFrozen[GrafcetCount];
+    bool InputActive[ArrayCount(Inputs)];
+    uint64_t OutputImage[OutputWordCount];
+    scheduler Scheduler;
+    uint32_t InputQueueDepth;
+    uint32_t InputQueueMaxDepth;
+    uint64_t InputsDropped;
+} snapshot;
+
+typedef struct {
+    _Atomic uint32_t Sequence;
+    snapshot Snapshot;
+} snapshot_buffer;
+
+static snapshot_buffer SnapshotBuffers[2];
+static _Atomic int LatestSnapshot = -1;
+static _Atomic bool RendererRunning;
+
+static void publishSnapshot(scheduler *Scheduler) {
+    snapshot_buffer *Buffer = SnapshotBuffers + (atomic_load_explicit(&LatestSnapshot, memory_order_relaxed) != 0 ? 0 : 1);
+    uint32_t Sequence = atomic_load_explicit(&Buffer->Sequence, memory_order_relaxed);
+    atomic_store_explicit(&Buffer->Sequence, Sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    snapshot *Snapshot = &Buffer->Snapshot;
+    Snapshot->ScanTime = ScanTime;
+    memcpy(Snapshot->ActiveStates, ActiveStates, sizeof(ActiveStates));
+    memcpy(Snapshot->StateActivatedAt, StateActivatedAt, sizeof(StateActivatedAt));
+    memcpy(Snapshot->GrafcetFrozen, GrafcetFrozen, sizeof(GrafcetFrozen));
+    for(int Index = 0; Index < ArrayCount(Inputs); ++Index) {
+        Snapshot->InputActive[Index] = Inputs[Index].Active;
+    }
+    memcpy(Snapshot->OutputImage, OutputImage, sizeof(OutputImage));
+    Snapshot->Scheduler = *Scheduler;
+    Snapshot->InputQueueDepth = inputQueueDepth(&InputQueue);
+    Snapshot->InputQueueMaxDepth = InputQueue.MaxDepth;
+    Snapshot->InputsDropped = atomic_load_explicit(&InputQueue.Dropped, memory_order_relaxed);
+
+    atomic_store_explicit(&Buffer->Sequence, Sequence + 2, memory_order_release);
+    atomic_store_explicit(&LatestSnapshot, (int)(Buffer - SnapshotBuffers), memory_order_release);
+}
+
+static bool readSnapshot(snapshot *Snapshot) {
+    for(;;) {
+        int Latest = atomic_load_explicit(&LatestSnapshot, memory_order_acquire);
+        if(Latest < 0) {
+            return false;
+        }
+        snapshot_buffer *Buffer = SnapshotBuffers + Latest;
+        uint32_t Sequence = atomic_load_explicit(&Buffer->Sequence, memory_order_acquire);
+        if(Sequence & 1) {
+            continue;
+        }
+        memcpy(Snapshot, &Buffer->Snapshot, sizeof(*Snapshot));
+        atomic_thread_fence(memory_order_acquire);
+        if(atomic_load_explicit(&Buffer->Sequence, memory_order_relaxed) == Sequence) {
+            return true;
+        }
+    }
+}
+
+static void renderGrafcet(display *Display, snapshot *Snapshot, int GrafcetId) {
+    const grafcet *Grafcet = Model.Grafcets + GrafcetId;
+    displayLine(Display, "Grafcet %d %s", GrafcetId, Snapshot->GrafcetFrozen[GrafcetId] ? blue("FROZEN") : "");
+    for(state_id Id = Grafcet->FirstState; Id < Grafcet->FirstState + Grafcet->StateCount; ++Id) {
+        if(Snapshot->ActiveStates[Id/64] & (1ull << (Id % 64))) {
+            displayLine(Display, "%5s: " green("Active") " %.1lfs", StateNames[Id],
+                        (Snapshot->ScanTime - Snapshot->StateActivatedAt[Id])/1e9);
+        } else {
+            displayLine(Display, "%5s: Inactive", StateNames[Id]);
+        }
+    }
+    displayLine(Display, "");
+}
+
+static void renderSnapshot(display *Display, snapshot *Snapshot) {
+    beginFrame(Display);
+    for(int GrafcetId = 0; GrafcetId < GrafcetCount; ++GrafcetId) {
+        renderGrafcet(Display, Snapshot, GrafcetId);
+    }
+
+    displayLine(Display, "Inputs:");
+    for(int Index = 1; Index < ArrayCount(Inputs); ++Index) {
+        displayLine(Display, "%10s (%c): %s", Inputs[Index].Name, Inputs[Index].Key,
+                    Snapshot->InputActive[Index] ? green("Active") : "Inactive");
+    }
+    displayLine(Display, "");
+    displayLine(Display, "Outputs:");
+    for(int Index = 0; Index < ArrayCount(Outputs); ++Index) {
+        displayLine(Display, "%10s: %s", Outputs[Index].Name, (Snapshot->OutputImage[Index/64] >> (Index%64)) & 1 ? green("Active") : "Inactive");
+    }
+
+    char Stats[256];
+    formatSchedulerStats(&Snapshot->Scheduler, Stats, sizeof(Stats));
+    displayLine(Display, "");
+    displayText(Display, Stats);
+    displayLine(Display, "Input queue: %u queued, %u at most, %llu dropped", Snapshot->InputQueueDepth,
+                Snapshot->InputQueueMaxDepth, (unsigned long long)Snapshot->InputsDropped);
+    endFrame(Display);
+}
+
+static void *runRenderer(void *Data) {
+    uint64_t Period = *(uint64_t *)Data;
+    static display Display;
+    static snapshot Snapshot;
+    uint64_t RenderedCycle = 0;
+    uint64_t Deadline = getNanoseconds();
+    while(atomic_load_explicit(&RendererRunning, memory_order_relaxed)) {
+        if(readSnapshot(&Snapshot) && Snapshot.Scheduler.Cycle != RenderedCycle) {
+            RenderedCycle = Snapshot.Scheduler.Cycle;
+            renderSnapshot(&Display, &Snapshot);
+        }
+
+        Deadline += Period;
+        struct timespec Time = {(time_t)(Deadline/1000000000ull), (long)(Deadline%1000000000ull)};
+        while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &Time, 0) == EINTR) {
+        }
+    }
+
+    // NOTE(nox): Final frame, so the display ends on the last published cycle
+    if(readSnapshot(&Snapshot) && Snapshot.Scheduler.Cycle != RenderedCycle) {
+        renderSnapshot(&Display, &Snapshot);
+    }
+    return 0;
+}
+
+static void resetEngine() {
+    memcpy(ActiveStates, Model.InitialStates, sizeof(ActiveStates));
+    memcpy(DirtyTransitions, Model.DeclaredTransitions, sizeof(DirtyTransitions));
+    memset(StateActivatedAt, 0, sizeof(StateActivatedAt));
+    resetTimers(0);
+    ScanTime = 0;
+    startTimers();
+    memset(GrafcetFrozen, 0, sizeof(GrafcetFrozen));
+    memset(GrafcetSuspended, 0, sizeof(GrafcetSuspended));
+    memset(GrafcetResetPending, 0, sizeof(GrafcetResetPending));
+    memset(GrafcetScannedAt, 0, sizeof(GrafcetScannedAt));
+    ScanTick = 0;
+    for(int Index = 0; Index < ArrayCount(Inputs); ++Index) {
+        Inputs[Index].Active = false;
+        Inputs[Index].ChangedAt = 0;
+    }
+    memset(RecordedFrozen, 0, sizeof(RecordedFrozen));
+    memset(OutputImage, 0, sizeof(OutputImage));
+    memset(PreviousOutputImage, 0, sizeof(PreviousOutputImage));
+    atomic_store(&FlightRecorder.Head, 0);
+}
+
+// NOTE(nox): Simulated cycle time, so timers advance in benchmarks without sleeping
+#define BENCHMARK_PERIOD 10000000ull
+#define BENCHMARK_SEED 12345
+
+// NOTE(nox): Headless run of ScanCount cycles with pseudo-random input toggles (never QUIT),
+// returning a hash of the situation and outputs of every cycle so engines can be compared
+
+static uint64_t runScans(int ScanCount, uint32_t Seed, uint64_t *Nanoseconds) {
+    resetEngine();
+    setScanRates(BENCHMARK_PERIOD);
+    uint32_t Random = Seed;
+    uint64_t Hash = 14695981039346656037ull;
+    uint64_t Start = getNanoseconds();
+    for(int Scan = 0; Scan < ScanCount; ++Scan) {
+        ScanTime = Scan*BENCHMARK_PERIOD;
+        profileStart(Start);
+        beginCycle();
+        profilePhase(Phase_OutputReset, Start);
+        Random = Random*1664525u + 1013904223u;
+        if((Random >> 24) < 64) {
+            toggleInput(1 + (Random >> 8) % (ArrayCount(Inputs) - 1));
+        }
+        profilePhase(Phase_InputApply, Start);
+        updateTimers();
+        profilePhase(Phase_Timers, Start);
+        scanGrafcets();
+        endProfiledCycle();
+        releaseGrafcets();
+
+        for(int Word = 0; Word < StateWordCount; ++Word) {
+            Hash = (Hash ^ ActiveStates[Word])*1099511628211ull;
+        }
+        for(int Word = 0; Word < OutputWordCount; ++Word) {
+            Hash = (Hash ^ OutputImage[Word])*1099511628211ull;
+        }
+    }
+    *Nanoseconds = getNanoseconds() - Start;
+    return Hash;
+}
+
+// NOTE(nox): The engines a benchmark compares, on the same inputs: the generic one calling the
+// compiled conditions and actions, the generated scans and the bytecode interpreter
+static const char *const EngineNames[] = {"generic", "generated", "bytecode"};
+
+static bool generatedScansMatchModel() {
+#if defined(GENERATED_SCAN_FUNCTIONS)
+    return Model.TopologyHash == TOPOLOGY_HASH && Model.CompiledBehaviour;
+#else
+    return false;
+#endif
+}
+
+static void runBenchmark(int ScanCount) {
+    bool Available[ArrayCount(EngineNames)] = {Model.CompiledBehaviour, generatedScansMatchModel(), true};
+    int DeclaredTransitions = 0;
+    for(int GrafcetId = 0; GrafcetId < GrafcetCount; ++GrafcetId) {
+        DeclaredTransitions += Model.Grafcets[GrafcetId].TransitionCount;
+    }
+
+    uint64_t FirstHash = 0;
+    int RunCount = 0;
+    bool Match = true;
+    printf("%d scans, %d grafcets in %d levels, %d transitions, %d scan threads\n", ScanCount, GrafcetCount,
+           Model.GrafcetLevelCount, DeclaredTransitions, ScanPool.ThreadCount > 1 ? ScanPool.ThreadCount : 1);
+    for(int Engine = 0; Engine < ArrayCount(EngineNames); ++Engine) {
+        if(!Available[Engine]) {
+            continue;
+        }
+        uint64_t Nanoseconds;
+        UseGeneratedScans = (Engine == 1);
+        UseBytecode = (Engine == 2);
+#if defined(PROFILE)
+        resetProfile();
+#endif
+        uint64_t Hash = runScans(ScanCount, BENCHMARK_SEED, &Nanoseconds);
+        printf("%10s: %12.0lf scans/s %10.1lf ns/scan %8.2lf ns/transition\n", EngineNames[Engine],
+               ScanCount*1e9/Nanoseconds, (double)Nanoseconds/ScanCount,
+               (double)Nanoseconds/ScanCount/DeclaredTransitions);
+#if defined(PROFILE)
+        dumpProfile(stdout);
+#endif
+        if(RunCount++ == 0) {
+            FirstHash = Hash;
+        }
+        Match = Match && Hash == FirstHash;
+    }
+    if(RunCount > 1) {
+        printf("Results %s (%016llx)\n", Match ? "match" : "DIFFER", (unsigned long long)FirstHash);
+    } else {
+        printf("Results %016llx (the conditions and actions of the model are only in bytecode)\n",
+               (unsigned long long)FirstHash);
+    }
+
+    struct rusage Usage;
+    getrusage(RUSAGE_SELF, &Usage);
+    printf("Peak RSS: %ld KiB\n", Usage.ru_maxrss);
+    UseGeneratedScans = false;
+}
+
+// NOTE(nox): What the old layout (1024-slot state lists inside every transition and grafcet)
+// would have needed for the same model, so the gain can be checked on real models
+#define LEGACY_MAX_STATES 1024
+#define LEGACY_MAX_TRANSITIONS 1024
+
+static void printFootprint() {
+    int DeclaredStates = 0, DeclaredTransitions = 0;
+    for(int GrafcetId = 0; GrafcetId < GrafcetCount; ++GrafcetId) {
+        DeclaredStates += Grafcets[GrafcetId].StateCount;
+        DeclaredTransitions += Grafcets[GrafcetId].TransitionCount;
+    }
+
+    size_t LegacyTransitions = (size_t)DeclaredTransitions*2*(sizeof(int) + LEGACY_MAX_STATES*sizeof(state_id));
+    size_t LegacyGrafcets = (size_t)GrafcetCount*(2*sizeof(int) + LEGACY_MAX_STATES*sizeof(state_id) +
+                                                  LEGACY_MAX_TRANSITIONS*sizeof(transition_id));
+    size_t Links = (sizeof(TransitionLinkOffsets) + sizeof(TransitionLinks) +
+                    sizeof(TransitionPreviousMasks) + sizeof(TransitionNextMasks) + sizeof(StateMaskWords));
+
+    printf("Topology footprint (%d grafcets, %d states, %d transitions, %zu links, %d bitset words):\n",
+           GrafcetCount, DeclaredStates, DeclaredTransitions, ArrayCount(TransitionLinks),
+           StateWordCount + TransitionWordCount);
+    printf("%12s: %10zu bytes (fixed arrays: %zu)\n", "Transitions", Links, LegacyTransitions);
+    printf("%12s: %10zu bytes (fixed arrays: %zu)\n", "Grafcets", sizeof(Grafcets), LegacyGrafcets);
+    printf("%12s: %10zu bytes (fixed arrays: %zu)\n", "Total", Links + sizeof(Grafcets),
+           LegacyTransitions + LegacyGrafcets);
+}
+
+#include "batch.h"
+
+// NOTE(nox): Same inputs as runScans, instance I being seeded with BENCHMARK_SEED + I
+static void runBatchBenchmark(int ScanCount, uint32_t InstanceCount) {
+    initBatch(InstanceCount);
+    setScanRates(BENCHMARK_PERIOD);
+    uint32_t *Randoms = malloc(InstanceCount*sizeof(uint32_t));
+    for(uint32_t Instance = 0; Instance < InstanceCount; ++Instance) {
+        Randoms[Instance] = BENCHMARK_SEED + Instance;
+    }
+
+    uint64_t Start = getNanoseconds();
+    for(int Scan = 0; Scan < ScanCount; ++Scan) {
+        ScanTime = Scan*BENCHMARK_PERIOD;
+        beginBatchCycle();
+        for(uint32_t Instance = 0; Instance < InstanceCount; ++Instance) {
+            uint32_t Random = Randoms[Instance] = Randoms[Instance]*1664525u + 1013904223u;
+            if((Random >> 24) < 64) {
+                toggleBatchInput(1 + (Random >> 8) % (ArrayCount(Inputs) - 1), Instance);
+            }
+        }
+        scanBatch();
+    }
+    uint64_t Nanoseconds = getNanoseconds() - Start;
+    double InstanceScans = (double)ScanCount*InstanceCount;
+    printf("%d scans of %u instances: %12.0lf instance-scans/s %10.1lf ns/instance-scan\n", ScanCount,
+           InstanceCount, InstanceScans*1e9/Nanoseconds, Nanoseconds/InstanceScans);
+
+    // NOTE(nox): The first and last instances must end where the single-instance engine does
+    uint32_t Checked[] = {0, InstanceCount - 1};
+    bool Match = true;
+    for(int Index = 0; Index < ArrayCount(Checked); ++Index) {
+        runScans(ScanCount, BENCHMARK_SEED + Checked[Index], &Nanoseconds);
+        Match = Match && batchInstanceMatches(Checked[Index]);
+    }
+    printf("Instances %u and %u %s the single-instance engine\n", Checked[0], Checked[1],
+           Match ? "match" : "DIFFER from");
+    free(Randoms);
+}
+
+// NOTE(nox): One line per step or output change, written by live runs with --history and by
+// replays, so the two can be diffed; the first cycle also lists the initial steps
+static uint64_t HistoryStates[StateWordCount];
+static uint64_t HistoryOutputs[OutputWordCount];
+
+static void writeHistory(FILE *File, uint64_t Cycle) {
+    for(int Word = 0; Word < StateWordCount; ++Word) {
+        for(uint64_t Changed = ActiveStates[Word] ^ HistoryStates[Word]; Changed; Changed &= Changed - 1) {
+            int Id = Word*64 + __builtin_ctzll(Changed);
+            fprintf(File, "%llu step %s %s\n", (unsigned long long)Cycle, StateNames[Id],
+                    isActive(Id) ? "on" : "off");
+        }
+        HistoryStates[Word] = ActiveStates[Word];
+    }
+    for(int Word = 0; Word < OutputWordCount; ++Word) {
+        for(uint64_t Changed = OutputImage[Word] ^ HistoryOutputs[Word]; Changed; Changed &= Changed - 1) {
+            int Index = 64*Word + __builtin_ctzll(Changed);
+            fprintf(File, "%llu output %s %s\n", (unsigned long long)Cycle, Outputs[Index].Name,
+                    outputActive(Index) ? "on" : "off");
+        }
+        HistoryOutputs[Word] = OutputImage[Word];
+    }
+}
+
+static trace_header traceHeader(uint64_t Period) {
+    trace_header Header = {0};
+    Header.InputCount = ArrayCount(Inputs);
+    Header.StateCount = StateCount;
+    Header.TransitionCount = TransitionCount;
+    Header.Period = Period;
+    return Header;
+}
+
+// NOTE(nox): Drives the engine from a recorded trace as fast as it goes: no scheduler, no
+// sleeping, no display
+static int runReplay(const char *TracePath, FILE *History) {
+    trace_reader Reader;
+    if(!openTraceReader(&Reader, TracePath)) {
+        fprintf(stderr, "Could not read the trace %s\n", TracePath);
+        return -1;
+    }
+    trace_header Expected = traceHeader(Reader.Header->Period);
+    if(Reader.Header->InputCount != Expected.InputCount || Reader.Header->StateCount != Expected.StateCount ||
+       Reader.Header->TransitionCount != Expected.TransitionCount) {
+        fprintf(stderr, "The trace %s was recorded with another model\n", TracePath);
+        closeTraceReader(&Reader);
+        return -1;
+    }
+
+    resetEngine();
+    setScanRates(Reader.Header->Period);
+    uint32_t Cycle = 1;
+    uint64_t Start = getNanoseconds();
+    for(; traceHasCycle(&Reader, Cycle); ++Cycle) {
+        ScanTime = readTraceTime(&Reader, Cycle);
+        beginCycle();
+        for(const trace_record *Record; (Record = readTraceInput(&Reader, Cycle));) {
+            if(Record->Input < ArrayCount(Inputs) && Inputs[Record->Input].Active != Record->Value) {
+                toggleInput(Record->Input);
+            }
+        }
+        updateTimers();
+        scanGrafcets();
+        if(History) {
+            writeHistory(History, Cycle);
+        }
+        releaseGrafcets();
+    }
+    uint64_t Nanoseconds = getNanoseconds() - Start;
+
+    fprintf(stderr, "Replayed %u cycles (%.1lfs of operation) in %.3lfs\n", Cycle - 1,
+            (double)ScanTime/1e9, (double)Nanoseconds/1e9);
+    closeTraceReader(&Reader);
+    return 0;
+}
+
+// NOTE(nox): Checkpoints (--checkpoint) hold the dynamic state of the engine at the end of a
+// cycle: steps, activation times of the active steps, supervision orders, inputs and outputs.
+// Timers are not stored, they are rebuilt from the activation times, and the restored engine
+// carries on from the checkpoint's scan time, so a timer does not count the time the engine was
+// stopped. Freezes are ordered again by every scan, so the stored ones only keep the flight
+// recorder consistent; suspensions and pending resets are restored.
+#define InputWordCount ((ArrayCount(Inputs) + 63)/64)
+
+static const char *CheckpointPath;
+static volatile sig_atomic_t CheckpointRequested;
+static uint64_t CheckpointPayload[StateWordCount + StateCount + 3*GrafcetWordCount + InputWordCount + OutputWordCount];
+static uint64_t CycleBase;
+static uint64_t TimeBase;
+
+static void requestCheckpoint(int Signal) {
+    CheckpointRequested = 1;
+}
+
+static checkpoint_header checkpointHeader() {
+    checkpoint_header Header = {0};
+    Header.TopologyHash = Model.TopologyHash;
+    Header.StateWordCount = StateWordCount;
+    Header.GrafcetCount = GrafcetCount;
+    Header.InputCount = ArrayCount(Inputs);
+    Header.OutputCount = ArrayCount(Outputs);
+    return Header;
+}
+
+static bool saveCheckpoint(uint64_t Cycle) {
+    checkpoint_header Header = checkpointHeader();
+    Header.Cycle = CycleBase + Cycle;
+    Header.ScanTime = ScanTime;
+
+    uint64_t *Word = CheckpointPayload;
+    memcpy(Word, ActiveStates, sizeof(ActiveStates));
+    Word += StateWordCount;
+    for(int StateWord = 0; StateWord < StateWordCount; ++StateWord) {
+        for(uint64_t Bits = ActiveStates[StateWord]; Bits; Bits &= Bits - 1) {
+            *Word++ = StateActivatedAt[64*StateWord + __builtin_ctzll(Bits)];
+            ++Header.ActiveCount;
+        }
+    }
+    memset(Word, 0, (3*GrafcetWordCount + InputWordCount)*sizeof(uint64_t));
+    for(int GrafcetId = 0; GrafcetId < GrafcetCount; ++GrafcetId) {
+        Word[GrafcetId/64] |= (uint64_t)GrafcetFrozen[GrafcetId] << (GrafcetId % 64);
+        Word[GrafcetWordCount + GrafcetId/64] |= (uint64_t)GrafcetSuspended[GrafcetId] << (GrafcetId % 64);
+        Word[2*GrafcetWordCount + GrafcetId/64] |= (uint64_t)GrafcetResetPending[GrafcetId] << (GrafcetId % 64);
+    }
+    Word += 3*GrafcetWordCount;
+    // NOTE(nox): QUIT is left out, or the restored engine would stop at once
+    for(int Index = 0; Index < ArrayCount(Inputs); ++Index) {
+        Word[Index/64] |= (uint64_t)(Inputs[Index].Active && Index != IO_QUIT) << (Index % 64);
+    }
+    Word += InputWordCount;
+    memcpy(Word, OutputImage, sizeof(OutputImage));
+    Word += OutputWordCount;
+
+    Header.PayloadWords = (uint32_t)(Word - CheckpointPayload);
+    return writeCheckpoint(CheckpointPath, Header, CheckpointPayload);
+}
+
+static int countActiveStates(const uint64_t *Words) {
+    int Count = 0;
+    for(int Word = 0; Word < StateWordCount; ++Word) {
+        Count += __builtin_popcountll(Words[Word]);
+    }
+    return Count;
+}
+
+static bool restoreCheckpoint(const char *Path, uint64_t Period) {
+    checkpoint Checkpoint;
+    if(!openCheckpoint(&Checkpoint, Path)) {
+        closeCheckpoint(&Checkpoint);
+        return false;
+    }
+    const checkpoint_header *Header = Checkpoint.Header;
+    checkpoint_header Expected = checkpointHeader();
+    const uint64_t *Word = Checkpoint.Payload;
+    if(Header->TopologyHash != Expected.TopologyHash || Header->StateWordCount != Expected.StateWordCount ||
+       Header->GrafcetCount != Expected.GrafcetCount || Header->InputCount != Expected.InputCount ||
+       Header->OutputCount != Expected.OutputCount ||
+       Header->PayloadWords != StateWordCount + Header->ActiveCount + 3*GrafcetWordCount + InputWordCount + OutputWordCount ||
+       countActiveStates(Word) != (int)Header->ActiveCount) {
+        closeCheckpoint(&Checkpoint);
+        return false;
+    }
+
+    memcpy(DirtyTransitions, Model.DeclaredTransitions, sizeof(DirtyTransitions));
+    memcpy(ActiveStates, Word, sizeof(ActiveStates));
+    Word += StateWordCount;
+    memset(StateActivatedAt, 0, sizeof(StateActivatedAt));
+    for(int StateWord = 0; StateWord < StateWordCount; ++StateWord) {
+        for(uint64_t Bits = ActiveStates[StateWord]; Bits; Bits &= Bits - 1) {
+            StateActivatedAt[64*StateWord + __builtin_ctzll(Bits)] = *Word++;
+        }
+    }
+    for(int GrafcetId = 0; GrafcetId < GrafcetCount; ++GrafcetId) {
+        RecordedFrozen[GrafcetId] = (Word[GrafcetId/64] >> (GrafcetId % 64)) & 1;
+        GrafcetSuspended[GrafcetId] = (Word[GrafcetWordCount + GrafcetId/64] >> (GrafcetId % 64)) & 1;
+        GrafcetResetPending[GrafcetId] = (Word[2*GrafcetWordCount + GrafcetId/64] >> (GrafcetId % 64)) & 1;
+    }
+    releaseGrafcets();
+    Word += 3*GrafcetWordCount;
+    for(int Index = 0; Index < ArrayCount(Inputs); ++Index) {
+        Inputs[Index].Active = (Word[Index/64] >> (Index % 64)) & 1;
+    }
+    Word += InputWordCount;
+    memcpy(OutputImage, Word, sizeof(OutputImage));
+    memcpy(PreviousOutputImage, Word, sizeof(PreviousOutputImage));
+
+    CycleBase = Header->Cycle;
+    ScanTime = Header->ScanTime;
+    TimeBase = ScanTime + Period;
+    resetTimers(millisecondsFromNanoseconds(ScanTime));
+    closeCheckpoint(&Checkpoint);
+    return true;
+}
+
+// NOTE(nox): A binary model (--model, written by the preprocessor with --model-file) replaces
+// the compiled topology. The file must come from a model with the same ids and names; what it
+// may change is how states and transitions are linked, the initial situation, the grafcet
+// levels and periods and, when all of them are in its bytecode, the conditions and actions,
+// which are then only run by the bytecode engine. Every index and program in it is checked once
+// here, so the engine uses the sections as it uses its own tables.
+_Static_assert(sizeof(grafcet) == sizeof(model_grafcet), "grafcet layout");
+_Static_assert(sizeof(state_mask) == sizeof(model_state_mask), "state_mask layout");
+_Static_assert(sizeof(dependency_list) == sizeof(model_dependency_list), "dependency_list layout");
+_Static_assert(sizeof(timer_threshold) == sizeof(model_timer_threshold), "timer_threshold layout");
+_Static_assert(sizeof(state_id) == sizeof(uint32_t) && sizeof(transition_id) == sizeof(uint32_t), "id layout");
+
+static model_file LoadedModel;
+
+static bool validIds(const uint32_t *Ids, uint64_t Count, uint32_t Limit) {
+    for(uint64_t Index = 0; Index < Count; ++Index) {
+        if(Ids[Index] >= Limit) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#define isDeclared(Declared, Id) ((Declared[(Id)/64] >> ((Id)%64)) & 1)
+
+// NOTE(nox): Padding slots have no outputs or conditions behind them, so every id the file uses
+// must be one the compiled grafcets declare, not only one below the slot count
+static bool declaredIds(const uint32_t *Ids, uint64_t Count, const uint64_t *Declared, uint32_t Limit) {
+    for(uint64_t Index = 0; Index < Count; ++Index) {
+        if(Ids[Index] >= Limit || !isDeclared(Declared, Ids[Index])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool declaredBits(const uint64_t *Words, const uint64_t *Declared, int WordCount) {
+    for(int Word = 0; Word < WordCount; ++Word) {
+        if(Words[Word] & ~Declared[Word]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// NOTE(nox): Marks the slots of one grafcet, which start a word of their own and are nobody else's
+static bool declareRange(uint64_t *Declared, uint32_t First, uint32_t Count, uint32_t Limit) {
+    if(First % 64 || First > Limit || Count > Limit - First) {
+        return false;
+    }
+    for(uint32_t Id = First; Id < First + Count; ++Id) {
+        if(isDeclared(Declared, Id)) {
+            return false;
+        }
+        Declared[Id/64] |= 1ull << (Id % 64);
+    }
+    return true;
+}
+
+static bool validDependencies(const dependency_list *Lists, int ListCount, const transition_id *Table,
+                              uint64_t TableCount, const uint64_t *Declared) {
+    for(int Index = 0; Index < ListCount; ++Index) {
+        if((uint64_t)Lists[Index].Offset + Lists[Index].Count > TableCount) {
+            return false;
+        }
+    }
+    return declaredIds((const uint32_t *)Table, TableCount, Declared, TransitionCount);
+}
+
+static bool validMasks(const state_mask *Masks, const uint64_t *MaskWords, uint64_t MaskWordCount,
+                       const uint64_t *DeclaredStates) {
+    for(int Id = 0; Id < TransitionCount; ++Id) {
+        if((uint64_t)Masks[Id].FirstWord + Masks[Id].WordCount > StateWordCount ||
+           (uint64_t)Masks[Id].Offset + Masks[Id].WordCount > MaskWordCount ||
+           !declaredBits(MaskWords + Masks[Id].Offset, DeclaredStates + Masks[Id].FirstWord,
+                         Masks[Id].WordCount)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool validNames(model_file *File, const uint32_t *Names, const char *const *Expected, int Count) {
+    uint64_t StringsSize = File->Header->Sections[ModelSection_Strings].Size;
+    for(int Id = 0; Id < Count; ++Id) {
+        if(Names[Id] >= StringsSize || strcmp(modelName(File, Names, Id), Expected[Id] ? Expected[Id] : "") != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool loadModel(const char *Path) {
+    model_file *File = &LoadedModel;
+    if(!openModelFile(File, Path)) {
+        closeModelFile(File);
+        return false;
+    }
+    const model_file_header *Header = File->Header;
+    bool CompiledBehaviour = (Header->BehaviourHash == BEHAVIOUR_HASH);
+    if((!CompiledBehaviour && Header->NativeCodeCount) || Header->GrafcetCount != GrafcetCount ||
+       Header->StateCount != StateCount || Header->TransitionCount != TransitionCount ||
+       Header->TimerThresholdCount != TimerThresholdCount || Header->InputCount != ArrayCount(Inputs) ||
+       Header->OutputCount != ArrayCount(Outputs) || Header->GrafcetLevelCount < 1 ||
+       Header->GrafcetLevelCount > GrafcetCount) {
+        closeModelFile(File);
+        return false;
+    }
+
+    model Loaded = {Header->TopologyHash, CompiledBehaviour, (int)Header->GrafcetLevelCount};
+    Loaded.Grafcets = modelSection(File, ModelSection_Grafcets, GrafcetCount, sizeof(grafcet));
+    Loaded.GrafcetLevelOffsets = modelSection(File, ModelSection_GrafcetLevelOffsets, Loaded.GrafcetLevelCount + 1,
+                                              sizeof(int));
+    Loaded.GrafcetsByLevel = modelSection(File, ModelSection_GrafcetsByLevel, GrafcetCount, sizeof(int));
+    Loaded.GrafcetPeriods = modelSection(File, ModelSection_GrafcetPeriods, GrafcetCount, sizeof(uint32_t));
+    Loaded.TransitionLinkOffsets = modelSection(File, ModelSection_TransitionLinkOffsets, 2*TransitionCount + 1,
+                                                sizeof(uint32_t));
+    uint64_t LinkCount = modelSectionCount(File, ModelSection_TransitionLinks, sizeof(state_id));
+    Loaded.TransitionLinks = modelSection(File, ModelSection_TransitionLinks, LinkCount, sizeof(state_id));
+    Loaded.TransitionPreviousMasks = modelSection(File, ModelSection_TransitionPreviousMasks, TransitionCount,
+                                                  sizeof(state_mask));
+    Loaded.TransitionNextMasks = modelSection(File, ModelSection_TransitionNextMasks, TransitionCount,
+                                              sizeof(state_mask));
+    uint64_t MaskWordCount = modelSectionCount(File, ModelSection_StateMaskWords, sizeof(uint64_t));
+    Loaded.StateMaskWords = modelSection(File, ModelSection_StateMaskWords, MaskWordCount, sizeof(uint64_t));
+    Loaded.TimerThresholds = modelSection(File, ModelSection_TimerThresholds, TimerThresholdCount,
+                                          sizeof(timer_threshold));
+    Loaded.StateTimerThresholds = modelSection(File, ModelSection_StateTimerThresholds, StateCount,
+                                               sizeof(dependency_list));
+    Loaded.InputReaders = modelSection(File, ModelSection_InputReaders, ArrayCount(Inputs), sizeof(dependency_list));
+    uint64_t InputReaderCount = modelSectionCount(File, ModelSection_InputReadersTransitions, sizeof(transition_id));
+    Loaded.InputReadersTransitions = modelSection(File, ModelSection_InputReadersTransitions, InputReaderCount,
+                                                  sizeof(transition_id));
+    Loaded.StateWatchers = modelSection(File, ModelSection_StateWatchers, StateCount, sizeof(dependency_list));
+    uint64_t WatcherCount = modelSectionCount(File, ModelSection_StateWatchersTransitions, sizeof(transition_id));
+    Loaded.StateWatchersTransitions = modelSection(File, ModelSection_StateWatchersTransitions, WatcherCount,
+                                                   sizeof(transition_id));
+    Loaded.StateTimerReaders = modelSection(File, ModelSection_StateTimerReaders, StateCount, sizeof(dependency_list));
+    uint64_t TimerReaderCount = modelSectionCount(File, ModelSection_StateTimerReadersTransitions,
+                                                  sizeof(transition_id));
+    Loaded.StateTimerReadersTransitions = modelSection(File, ModelSection_StateTimerReadersTransitions,
+                                                       TimerReaderCount, sizeof(transition_id));
+    Loaded.TimedStates = modelSection(File, ModelSection_TimedStates, StateWordCount, sizeof(uint64_t));
+    Loaded.VolatileTransitions = modelSection(File, ModelSection_VolatileTransitions, TransitionWordCount,
+                                              sizeof(uint64_t));
+    Loaded.InitialStates = modelSection(File, ModelSection_InitialStates, StateWordCount, sizeof(uint64_t));
+    Loaded.DeclaredTransitions = modelSection(File, ModelSection_DeclaredTransitions, TransitionWordCount,
+                                              sizeof(uint64_t));
+    uint64_t ConditionCodeSize = modelSectionCount(File, ModelSection_ConditionCode, sizeof(uint32_t));
+    Loaded.ConditionCode = modelSection(File, ModelSection_ConditionCode, ConditionCodeSize, sizeof(uint32_t));
+    Loaded.ConditionOffsets = modelSection(File, ModelSection_ConditionOffsets, TransitionCount, sizeof(uint32_t));
+    uint64_t ActionCodeSize = modelSectionCount(File, ModelSection_ActionCode, sizeof(uint32_t));
+    Loaded.ActionCode = modelSection(File, ModelSection_ActionCode, ActionCodeSize, sizeof(uint32_t));
+    Loaded.ActionOffsets = modelSection(File, ModelSection_ActionOffsets, StateCount, sizeof(uint32_t));
+    const uint32_t *StateNameOffsets = modelSection(File, ModelSection_StateNames, StateCount, sizeof(uint32_t));
+    const uint32_t *TransitionNameOffsets = modelSection(File, ModelSection_TransitionNames, TransitionCount,
+                                                         sizeof(uint32_t));
+    const uint32_t *InputNameOffsets = modelSection(File, ModelSection_InputNames, ArrayCount(Inputs),
+                                                    sizeof(uint32_t));
+    const char *InputKeys = modelSection(File, ModelSection_InputKeys, ArrayCount(Inputs), 1);
+    const uint32_t *OutputNameOffsets = modelSection(File, ModelSection_OutputNames, ArrayCount(Outputs),
+                                                     sizeof(uint32_t));
+
+    const void *Sections[] = {
+        Loaded.Grafcets, Loaded.GrafcetLevelOffsets, Loaded.GrafcetsByLevel, Loaded.GrafcetPeriods,
+        Loaded.TransitionLinkOffsets, Loaded.TransitionLinks, Loaded.TransitionPreviousMasks,
+        Loaded.TransitionNextMasks, Loaded.StateMaskWords, Loaded.TimerThresholds, Loaded.StateTimerThresholds,
+        Loaded.InputReaders, Loaded.InputReadersTransitions, Loaded.StateWatchers, Loaded.StateWatchersTransitions,
+        Loaded.StateTimerReaders, Loaded.StateTimerReadersTransitions, Loaded.TimedStates,
+        Loaded.VolatileTransitions, Loaded.InitialStates, Loaded.DeclaredTransitions, Loaded.ConditionCode,
+        Loaded.ConditionOffsets, Loaded.ActionCode, Loaded.ActionOffsets, StateNameOffsets, TransitionNameOffsets,
+        InputNameOffsets, InputKeys, OutputNameOffsets,
+    };
+    bool Valid = true;
+    for(int Index = 0; Index < ArrayCount(Sections); ++Index) {
+        Valid = Valid && Sections[Index];
+    }
+
+    // NOTE(nox): Names and keys must be the compiled ones, id by id
+    Valid = Valid && validNames(File, StateNameOffsets, StateNames, StateCount) &&
+        validNames(File, TransitionNameOffsets, TransitionNames, TransitionCount);
+    for(int Index = 0; Valid && Index < ArrayCount(Inputs); ++Index) {
+        const char *Name = Inputs[Index].Name;
+        Valid = validNames(File, InputNameOffsets + Index, &Name, 1) && InputKeys[Index] == Inputs[Index].Key;
+    }
+    for(int Index = 0; Valid && Index < ArrayCount(Outputs); ++Index) {
+        const char *Name = Outputs[Index].Name;
+        Valid = validNames(File, OutputNameOffsets + Index, &Name, 1);
+    }
+
+    // NOTE(nox): The grafcets must cover the same slots as the compiled ones, each in words of its
+    // own, and the sets of the file may only hold ids from them
+    uint64_t DeclaredStates[StateWordCount] = {0}, DeclaredTransitions[TransitionWordCount] = {0};
+    uint64_t FileStates[StateWordCount] = {0}, FileTransitions[TransitionWordCount] = {0};
+    for(int GrafcetId = 0; Valid && GrafcetId < GrafcetCount; ++GrafcetId) {
+        grafcet Grafcet = Loaded.Grafcets[GrafcetId];
+        Valid = (declareRange(DeclaredStates, Grafcets[GrafcetId].FirstState, Grafcets[GrafcetId].StateCount,
+                              StateCount) &&
+                 declareRange(DeclaredTransitions, Grafcets[GrafcetId].FirstTransition,
+                              Grafcets[GrafcetId].TransitionCount, TransitionCount) &&
+                 declareRange(FileStates, (uint32_t)Grafcet.FirstState, (uint32_t)Grafcet.StateCount, StateCount) &&
+                 declareRange(FileTransitions, (uint32_t)Grafcet.FirstTransition, (uint32_t)Grafcet.TransitionCount,
+                              TransitionCount));
+    }
+    Valid = Valid && declaredBits(FileStates, DeclaredStates, StateWordCount) &&
+        declaredBits(FileTransitions, DeclaredTransitions, TransitionWordCount) &&
+        declaredBits(Loaded.InitialStates, FileStates, StateWordCount) &&
+        declaredBits(Loaded.TimedStates, FileStates, StateWordCount) &&
+        declaredBits(Loaded.DeclaredTransitions, FileTransitions, TransitionWordCount) &&
+        declaredBits(Loaded.VolatileTransitions, FileTransitions, TransitionWordCount);
+    Valid = Valid && Loaded.GrafcetLevelOffsets[0] == 0 &&
+        Loaded.GrafcetLevelOffsets[Loaded.GrafcetLevelCount] == GrafcetCount &&
+        validIds((const uint32_t *)Loaded.GrafcetsByLevel, GrafcetCount, GrafcetCount);
+    for(int Level = 0; Valid && Level < Loaded.GrafcetLevelCount; ++Level) {
+        Valid = Loaded.GrafcetLevelOffsets[Level] < Loaded.GrafcetLevelOffsets[Level + 1];
+    }
+    // NOTE(nox): Each grafcet at exactly one level, or two threads could scan it at once
+    bool Leveled[GrafcetCount] = {0};
+    for(int Index = 0; Valid && Index < GrafcetCount; ++Index) {
+        Valid = !Leveled[Loaded.GrafcetsByLevel[Index]];
+        Leveled[Loaded.GrafcetsByLevel[Index]] = true;
+    }
+
+    Valid = Valid && Loaded.TransitionLinkOffsets[0] == 0 &&
+        declaredIds(Loaded.TransitionLinks, LinkCount, FileStates, StateCount);
+    for(int Index = 0; Valid && Index < 2*TransitionCount; ++Index) {
+        Valid = (Loaded.TransitionLinkOffsets[Index] <= Loaded.TransitionLinkOffsets[Index + 1] &&
+                 Loaded.TransitionLinkOffsets[Index + 1] <= LinkCount);
+    }
+    Valid = Valid && validMasks(Loaded.TransitionPreviousMasks, Loaded.StateMaskWords, MaskWordCount, FileStates) &&
+        validMasks(Loaded.TransitionNextMasks, Loaded.StateMaskWords, MaskWordCount, FileStates);
+
+    for(int Index = 0; Valid && Index < TimerThresholdCount; ++Index) {
+        timer_threshold Threshold = Loaded.TimerThresholds[Index];
+        Valid = ((uint32_t)Threshold.State < StateCount && isDeclared(FileStates, Threshold.State) &&
+                 (uint32_t)Threshold.Transition < TransitionCount &&
+                 isDeclared(FileTransitions, Threshold.Transition) && (uint32_t)Threshold.Grafcet < GrafcetCount);
+    }
+    for(int Id = 0; Valid && Id < StateCount; ++Id) {
+        Valid = (uint64_t)Loaded.StateTimerThresholds[Id].Offset + Loaded.StateTimerThresholds[Id].Count <=
+            TimerThresholdCount;
+    }
+    Valid = Valid &&
+        validDependencies(Loaded.InputReaders, ArrayCount(Inputs), Loaded.InputReadersTransitions, InputReaderCount,
+                          FileTransitions) &&
+        validDependencies(Loaded.StateWatchers, StateCount, Loaded.StateWatchersTransitions, WatcherCount,
+                          FileTransitions) &&
+        validDependencies(Loaded.StateTimerReaders, StateCount, Loaded.StateTimerReadersTransitions, TimerReaderCount,
+                          FileTransitions);
+
+    // NOTE(nox): The compiled conditions and actions can only stand in for the model's own
+    code_limits Limits = {ArrayCount(Inputs), ArrayCount(Outputs), StateCount, TransitionCount, GrafcetCount,
+                          CompiledBehaviour};
+    uint64_t CodeSize = ConditionCodeSize > ActionCodeSize ? ConditionCodeSize : ActionCodeSize;
+    Valid = Valid && CodeSize <= CODE_MAX_OPERAND;
+    int8_t *Depths = Valid ? malloc(CodeSize + 1) : 0;
+    if(Depths) {
+        memset(Depths, -1, CodeSize + 1);
+    }
+    for(int Id = 0; Valid && Id < TransitionCount; ++Id) {
+        Valid = verifyCode(Loaded.ConditionCode, (uint32_t)ConditionCodeSize, Loaded.ConditionOffsets[Id], true,
+                           Limits, Depths);
+    }
+    for(int Id = 0; Valid && Id < StateCount; ++Id) {
+        Valid = verifyCode(Loaded.ActionCode, (uint32_t)ActionCodeSize, Loaded.ActionOffsets[Id], false, Limits,
+                           Depths);
+    }
+    free(Depths);
+
+    if(!Valid) {
+        closeModelFile(File);
+        return false;
+    }
+    Model = Loaded;
+    return true;
+}
+
+int main(int Argc, char *Argv[]) {
+    bool Footprint = false;
+    int BenchmarkScans = 0;
+    double PeriodMs = 100;
+    double RefreshMs = 50;
+    bool Headless = false;
+    int ScanThreads = 1;
+    int InstanceCount = 0;
+    const char *InputPath = 0;
+    const char *InputSocketPath = 0;
+    const char *RecordPath = 0;
+    const char *ReplayPath = 0;
+    const char *HistoryPath = 0;
+    bool DumpFlightRecorder = false;
+    const char *OutputSinkPath = 0;
+    const char *ProcessImageName = 0;
+    int CheckpointEvery = 0;
+    const char *ModelPath = 0;
+    overrun_policy Policy = Overrun_Skip;
+    for(int ArgIndex = 1; ArgIndex < Argc; ++ArgIndex) {
+        if(strcmp(Argv[ArgIndex], "--footprint") == 0) {
+            Footprint = true;
+        } else if(strcmp(Argv[ArgIndex], "--period") == 0 && ArgIndex + 1 < Argc && atof(Argv[ArgIndex + 1]) > 0) {
+            PeriodMs = atof(Argv[++ArgIndex]);
+        } else if(strcmp(Argv[ArgIndex], "--refresh") == 0 && ArgIndex + 1 < Argc && atof(Argv[ArgIndex + 1]) > 0) {
+            RefreshMs = atof(Argv[++ArgIndex]);
+        } else if(strcmp(Argv[ArgIndex], "--headless") == 0) {
+            Headless = true;
+        } else if(strcmp(Argv[ArgIndex], "--overrun") == 0 && ArgIndex + 1 < Argc &&
+                  parseOverrunPolicy(Argv[ArgIndex + 1], &Policy)) {
+            ++ArgIndex;
+        } else if(strcmp(Argv[ArgIndex], "--threads") == 0 && ArgIndex + 1 < Argc && atoi(Argv[ArgIndex + 1]) > 0) {
+            ScanThreads = atoi(Argv[++ArgIndex]);
+        } else if(strcmp(Argv[ArgIndex], "--instances") == 0 && ArgIndex + 1 < Argc && atoi(Argv[ArgIndex + 1]) > 0) {
+            InstanceCount = atoi(Argv[++ArgIndex]);
+        } else if(strcmp(Argv[ArgIndex], "--input") == 0 && ArgIndex + 1 < Argc) {
+            InputPath = Argv[++ArgIndex];
+        } else if(strcmp(Argv[ArgIndex], "--input-socket") == 0 && ArgIndex + 1 < Argc) {
+            InputSocketPath = Argv[++ArgIndex];
+        } else if(strcmp(Argv[ArgIndex], "--record") == 0 && ArgIndex + 1 < Argc) {
+            RecordPath = Argv[++ArgIndex];
+        } else if(strcmp(Argv[ArgIndex], "--replay") == 0 && ArgIndex + 1 < Argc) {
+            ReplayPath = Argv[++ArgIndex];
+        } else if(strcmp(Argv[ArgIndex], "--history") == 0 && ArgIndex + 1 < Argc) {
+            HistoryPath = Argv[++ArgIndex];
+        } else if(strcmp(Argv[ArgIndex], "--flight-recorder") == 0 && ArgIndex + 1 < Argc) {
+            FlightRecorderPath = Argv[++ArgIndex];
+            DumpFlightRecorder = true;
+        } else if(strcmp(Argv[ArgIndex], "--output-sink") == 0 && ArgIndex + 1 < Argc) {
+            OutputSinkPath = Argv[++ArgIndex];
+        } else if(strcmp(Argv[ArgIndex], "--shm") == 0 && ArgIndex + 1 < Argc) {
+            ProcessImageName = Argv[++ArgIndex];
+        } else if(strcmp(Argv[ArgIndex], "--checkpoint") == 0 && ArgIndex + 1 < Argc) {
+            CheckpointPath = Argv[++ArgIndex];
+        } else if(strcmp(Argv[ArgIndex], "--checkpoint-every") == 0 && ArgIndex + 1 < Argc &&
+                  atoi(Argv[ArgIndex + 1]) > 0) {
+            CheckpointEvery = atoi(Argv[++ArgIndex]);
+        } else if(strcmp(Argv[ArgIndex], "--model") == 0 && ArgIndex + 1 < Argc) {
+            ModelPath = Argv[++ArgIndex];
+        } else if(strcmp(Argv[ArgIndex], "--bench") == 0 && ArgIndex + 1 < Argc) {
+            BenchmarkScans = atoi(Argv[++ArgIndex]);
+#if defined(GENERATED_SCAN_FUNCTIONS)
+        } else if(strcmp(Argv[ArgIndex], "--generated") == 0) {
+            UseGeneratedScans = true;
+#endif
+        } else if(strcmp(Argv[ArgIndex], "--bytecode") == 0) {
+            UseBytecode = true;
+        } else {
+            fprintf(stderr, "Usage: %s [--model path] [--footprint] [--bench scans [--instances N]]\n"
+                    "       [--generated | --bytecode] [--period ms] [--overrun skip|catch-up|degrade]\n"
+                    "       [--headless | --refresh ms] [--threads N]\n"
+                    "       [--input path] [--input-socket path] [--record trace | --replay trace] [--history path]\n"
+                    "       [--flight-recorder path] [--output-sink path] [--shm name]\n"
+                    "       [--checkpoint path [--checkpoint-every cycles]]\n", Argv[0]);
+            return -1;
+        }
+    }
+
+#define MODEL_DECLARATIONS
+#include MODEL
+#undef MODEL_DECLARATIONS
+
+    if(ModelPath) {
+        uint64_t Start = getNanoseconds();
+        if(!loadModel(ModelPath)) {
+            fprintf(stderr, "The model %s is damaged or does not match the ids and names of the compiled one\n",
+                    ModelPath);
+            return -1;
+        }
+        fprintf(stderr, "Loaded the model %s in %.1lfus\n", ModelPath, (getNanoseconds() - Start)/1e3);
+        // NOTE(nox): The generated scans have the compiled topology and behaviour built in, and
+        // the batch engine the compiled behaviour
+        if(UseGeneratedScans && !generatedScansMatchModel()) {
+            fprintf(stderr, "The generated scans do not match %s\n", ModelPath);
+            return -1;
+        }
+        if(!Model.CompiledBehaviour) {
+            if(InstanceCount > 0) {
+                fprintf(stderr, "The batch engine needs the compiled conditions and actions\n");
+                return -1;
             }
-            puts("");
+            fprintf(stderr, "The conditions and actions of %s are not the compiled ones, running their bytecode\n",
+                    ModelPath);
+            UseBytecode = true;
+        }
+        resetEngine();
+    }
 
-            // NOTE(nox): Disable freeze
-            Grafcet->Frozen = false;
+    if(Footprint) {
+        printFootprint();
+        return 0;
+    }
+    if(ScanThreads > 1) {
+        startWorkerPool(&ScanPool, ScanThreads);
+        FlightRecorder.Shared = OutputsShared = (ScanPool.ThreadCount > 1);
+    }
+    if(BenchmarkScans > 0 && InstanceCount > 0) {
+        runBatchBenchmark(BenchmarkScans, InstanceCount);
+        stopWorkerPool(&ScanPool);
+        return 0;
+    }
+    if(BenchmarkScans > 0) {
+        runBenchmark(BenchmarkScans);
+        stopWorkerPool(&ScanPool);
+        return 0;
+    }
+
+    startFlightRecorder();
+
+    // NOTE(nox): Opening a FIFO waits for its reader
+    if(OutputSinkPath) {
+        int Fd = open(OutputSinkPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(Fd < 0 || !addOutputFd(&OutputSinks, Fd)) {
+            fprintf(stderr, "Could not open the output sink %s\n", OutputSinkPath);
+            stopWorkerPool(&ScanPool);
+            return -1;
+        }
+    }
+
+    // NOTE(nox): Replays write the history to stdout unless --history says otherwise, and dump the
+    // flight recorder at the end when --flight-recorder is given
+    FILE *History = 0;
+    if(HistoryPath) {
+        History = fopen(HistoryPath, "w");
+        if(!History) {
+            fprintf(stderr, "Could not open the history file %s\n", HistoryPath);
+            stopWorkerPool(&ScanPool);
+            return -1;
         }
+    } else if(ReplayPath) {
+        History = stdout;
+    }
+    if(History) {
+        setvbuf(History, 0, _IOFBF, 1 << 16);
+    }
+    if(ReplayPath) {
+        int Result = runReplay(ReplayPath, History);
+        if(Result == 0 && DumpFlightRecorder) {
+            dumpFlightRecorder(&FlightRecorder, FlightHeader, FlightRecorderPath);
+        }
+        fclose(History);
+        stopWorkerPool(&ScanPool);
+        return Result;
+    }
+
+    scheduler Scheduler;
+    initScheduler(&Scheduler, (uint64_t)(PeriodMs*1e6), Policy);
+    if(!setScanRates(Scheduler.BasePeriod)) {
+        fprintf(stderr, "Note: grafcet periods rounded to whole cycles of %.1lfms\n", PeriodMs);
+    }
+
+    // NOTE(nox): A missing checkpoint is a cold start; one that does not match this model is left
+    // alone (it is replaced by the first checkpoint written)
+    if(CheckpointPath) {
+        uint64_t Start = getNanoseconds();
+        if(restoreCheckpoint(CheckpointPath, Scheduler.BasePeriod)) {
+            fprintf(stderr, "Restored cycle %llu from %s in %.1lfus\n", (unsigned long long)CycleBase,
+                    CheckpointPath, (getNanoseconds() - Start)/1e3);
+        } else if(access(CheckpointPath, F_OK) == 0) {
+            fprintf(stderr, "The checkpoint %s is damaged or from another model, starting from the initial situation\n",
+                    CheckpointPath);
+        }
+        signal(SIGPWR, requestCheckpoint);
+    }
+    startTimers();
 
-        printf("Inputs:\n");
-        for(int Index = 1; Index < ArrayCount(Inputs); ++Index) {
-            printf("%10s (%c): %s\n", Inputs[Index].Name, Inputs[Index].Key,
-                   Inputs[Index].Active ? green("Active") : "Inactive");
+    trace_writer Trace = {0};
+    if(RecordPath && !openTraceWriter(&Trace, RecordPath, traceHeader(Scheduler.BasePeriod))) {
+        fprintf(stderr, "Could not create the trace %s\n", RecordPath);
+        stopWorkerPool(&ScanPool);
+        return -1;
+    }
+
+#if defined(PROFILE)
+    ticksPerNanosecond();
+    signal(SIGUSR1, requestProfileDump);
+#endif
+
+    if(ProcessImageName) {
+        ProcessImage = createProcessImage(ProcessImageName, ArrayCount(Inputs), ArrayCount(Outputs), StateWordCount);
+        if(!ProcessImage) {
+            fprintf(stderr, "Could not create the process image %s\n", ProcessImageName);
+            stopWorkerPool(&ScanPool);
+            return -1;
+        }
+        for(int Index = 0; Index < ArrayCount(Inputs); ++Index) {
+            strncpy(processImageName(ProcessImage, InputNamesOffset, Index), Inputs[Index].Name, PROCESS_IMAGE_NAME_LENGTH - 1);
         }
-        puts("");
-        printf("Outputs:\n");
         for(int Index = 0; Index < ArrayCount(Outputs); ++Index) {
-            printf("%10s: %s\n", Outputs[Index].Name, Outputs[Index].Active ? green("Active") : "Inactive");
+            strncpy(processImageName(ProcessImage, OutputNamesOffset, Index), Outputs[Index].Name, PROCESS_IMAGE_NAME_LENGTH - 1);
         }
+        publishProcessImage(ProcessImage);
+    }
 
-        puts("\n");
-        usleep(100000);
+    // NOTE(nox): The keyboard is always a source; --input adds a file or FIFO and --input-socket a
+    // local socket whose connections are sources, all with the same keys
+    static input_acquisition Acquisition;
+    if(!initInputAcquisition(&Acquisition, &InputQueue)) {
+        fprintf(stderr, "Could not set up the input acquisition\n");
+        stopInputAcquisition(&Acquisition);
+        stopWorkerPool(&ScanPool);
+        return -1;
+    }
+    for(int Input = 0; Input < ArrayCount(Inputs); ++Input) {
+        bindInputKey(Acquisition.KeyInputs, Inputs[Input].Key, Input);
+    }
+    addInputSource(&Acquisition, STDIN_FILENO, false);
+    if(InputPath) {
+        int Fd = open(InputPath, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if(Fd < 0 || !addInputSource(&Acquisition, Fd, true)) {
+            fprintf(stderr, "Could not open input source %s\n", InputPath);
+        }
+    }
+    if(InputSocketPath && !listenInputSocket(&Acquisition, InputSocketPath)) {
+        fprintf(stderr, "Could not listen for inputs on %s\n", InputSocketPath);
+    }
+    if(!startInputAcquisition(&Acquisition)) {
+        fprintf(stderr, "Could not start the input acquisition\n");
+        stopInputAcquisition(&Acquisition);
+        stopWorkerPool(&ScanPool);
+        return -1;
+    }
+
+    pthread_t Renderer;
+    uint64_t RefreshPeriod = (uint64_t)(RefreshMs*1e6);
+    if(!Headless) {
+        atomic_store(&RendererRunning, true);
+        if(pthread_create(&Renderer, 0, runRenderer, &RefreshPeriod) != 0) {
+            fprintf(stderr, "Could not start the renderer, running headless\n");
+            Headless = true;
+        }
+    }
+
+    // NOTE(nox): Generic grafcet logic ----------------------------------------
+    for(;;) {
+        if(Inputs[IO_QUIT].Active) {
+            break;
+        }
+
+        waitForNextCycle(&Scheduler);
+        ScanTime = TimeBase + cycleTime(&Scheduler);
+        traceCycleTime(&Trace, (uint32_t)Scheduler.Cycle, ScanTime);
+
+        profileStart(Start);
+        beginCycle();
+        profilePhase(Phase_OutputReset, Start);
+
+        // NOTE(nox): Apply the edges acquired since the last cycle
+        if(ProcessImage) {
+            readProcessImage(getNanoseconds());
+        }
+        applyInputEdges(&InputQueue);
+        applyInputEdges(&ProcessQueue);
+        if(Trace.File) {
+            for(int Index = 0; Index < ArrayCount(Inputs); ++Index) {
+                if(Inputs[Index].ChangedAt == ScanTick) {
+                    traceInput(&Trace, (uint32_t)Scheduler.Cycle, Index, Inputs[Index].Active);
+                }
+            }
+        }
+
+        profilePhase(Phase_InputApply, Start);
+        updateTimers();
+        profilePhase(Phase_Timers, Start);
+        scanGrafcets();
+        if(ProcessImage) {
+            writeProcessOutputs(ProcessImage, Scheduler.Cycle, ScanTime, OutputImage, ActiveStates);
+        }
+
+        if(!Headless) {
+            profileStart(DisplayStart);
+            publishSnapshot(&Scheduler);
+            profilePhase(Phase_Display, DisplayStart);
+        }
+        endProfiledCycle();
+        endFlightRecorderCycle();
+        if(History) {
+            writeHistory(History, Scheduler.Cycle);
+        }
+        if(CheckpointPath && (CheckpointRequested || (CheckpointEvery && Scheduler.Cycle % CheckpointEvery == 0))) {
+            CheckpointRequested = 0;
+            if(!saveCheckpoint(Scheduler.Cycle)) {
+                fprintf(stderr, "Could not write the checkpoint %s\n", CheckpointPath);
+            }
+        }
+
+        releaseGrafcets();
+    }
+
+    if(!Headless) {
+        atomic_store(&RendererRunning, false);
+        pthread_join(Renderer, 0);
+    }
+    stopWorkerPool(&ScanPool);
+    if(CheckpointPath && !saveCheckpoint(Scheduler.Cycle)) {
+        fprintf(stderr, "Could not write the checkpoint %s\n", CheckpointPath);
+    }
+    stopInputAcquisition(&Acquisition);
+    closeTraceWriter(&Trace, Scheduler.Cycle);
+    if(ProcessImage) {
+        closeProcessImage(ProcessImage);
+        shm_unlink(ProcessImageName);
+    }
+    if(History) {
+        fclose(History);
+    }
+    puts("");
+    printSchedulerStats(&Scheduler);
+    for(int Index = 0; Index < OutputSinks.Count; ++Index) {
+        if(OutputSinks.Sinks[Index].Dropped) {
+            printf("Output sink %d dropped %llu changes\n", Index, (unsigned long long)OutputSinks.Sinks[Index].Dropped);
+        }
+    }
+    printf("Input queue: %u edges at most, %llu dropped\n", InputQueue.MaxDepth,
+           (unsigned long long)atomic_load(&InputQueue.Dropped));
+    if(Acquisition.RefusedConnections) {
+        printf("Input socket refused %llu connections\n", (unsigned long long)Acquisition.RefusedConnections);
     }
 
     return 0;
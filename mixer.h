@@ -0,0 +1,70 @@
+// -------------------------
+// Generic Grafcet Framework - Mixer model
+// -------------------------
+
+// MIT License:
+//
+// Copyright 2018 Gonçalo Santos
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+// NOTE(nox): Included twice by main.c: first for the inputs and outputs (QUIT must come first),
+// then inside main with MODEL_DECLARATIONS for the grafcets, which is also what the
+// preprocessor reads. Any file with the same layout can be used with -DMODEL.
+#if defined(MODEL_DECLARATIONS)
+
+    // NOTE(nox): Control Grafcet, whose valves and timers need no more than 100ms
+    grafcetPeriod(1, 100);
+    newInitialState(1, 1, {});
+    newTransition(1, 1, ARR(State_X1), ARR(State_X2, State_X4, State_X6), (input(CICLO)));
+
+    newState(1, 2, { output(V1); });
+    newState(1, 3, {});
+    newTransition(1, 2, ARR(State_X2), ARR(State_X3), (input(PRATO1)));
+
+    newState(1, 4, { output(V3); });
+    newState(1, 5, {});
+    newTransition(1, 3, ARR(State_X4), ARR(State_X5), (input(PRATO2)));
+
+    newState(1, 6, { if(!input(M_MAX)) output(BOMBA_V5); });
+    newTransition(1, 4, ARR(State_X3, State_X5, State_X6), ARR(State_X7), (input(M_MAX)));
+
+    newState(1, 7, { output(ESQUERDA); output(MOTOR_PA); output(V2); output(V4);  });
+    newTransition(1, 5, ARR(State_X7), ARR(State_X8), (timer(7)>=3000));
+
+    newState(1, 8, { output(ESQUERDA); output(MOTOR_PA); });
+    newTransition(1, 6, ARR(State_X8), ARR(State_X9), (timer(8)>=4000));
+
+    newState(1, 9, { output(V7); });
+    newTransition(1, 7, ARR(State_X9), ARR(State_X1), (input(M_MIN)));
+
+
+    // NOTE(nox): Supervisor Grafcet
+    newInitialState(0, s1, {});
+    newTransition(0, s1, ARR(State_Xs1), ARR(State_Xs2), ((active(2) || active(4) || active(6) || active(7)) &&
+                                                          RE(PARAGEM)));
+    newState(0, s2, { freeze(1); });
+    newTransition(0, s2, ARR(State_Xs2), ARR(State_Xs1), (!input(PARAGEM)));
+
+#else
+
+#define inputMacro(W) W(QUIT, 'q'), W(M_MAX, 'a'), W(M_MIN, 's'), W(PRATO1, 'd'), W(PRATO2, 'f'), \
+    W(PARAGEM, 'p'), W(CICLO, 'c')
+#define outputMacro(W) W(ESQUERDA), W(BOMBA_V5), W(MOTOR_PA), W(V1), W(V2), W(V3), W(V4), W(V7)
+
+#endif
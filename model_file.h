@@ -0,0 +1,293 @@
+// -------------------------
+// Generic Grafcet Framework - Binary models
+// -------------------------
+
+// MIT License:
+//
+// Copyright 2018 Gonçalo Santos
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+
+#if !defined(MODEL_FILE_H)
+#define MODEL_FILE_H
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// NOTE(nox): A binary model is the topology the preprocessor emits as C tables, in a file the
+// engine maps and uses in place: a header with the counts and a directory of sections, each an
+// array with the layout of the engine's table of the same name, 8 byte aligned and addressed by
+// its offset from the start of the file. Names are offsets into the Strings section, so nothing
+// in the file depends on where it is mapped.
+#define MODEL_FILE_MAGIC 0x4d474747 // NOTE(nox): "GGGM"
+#define MODEL_FILE_VERSION 3
+
+typedef enum {
+    ModelSection_Grafcets,
+    ModelSection_GrafcetLevelOffsets,
+    ModelSection_GrafcetsByLevel,
+    // NOTE(nox): uint32_t milliseconds between the scans of every grafcet, 0 for every cycle
+    ModelSection_GrafcetPeriods,
+    ModelSection_TransitionLinkOffsets,
+    ModelSection_TransitionLinks,
+    ModelSection_TransitionPreviousMasks,
+    ModelSection_TransitionNextMasks,
+    ModelSection_StateMaskWords,
+    ModelSection_TimerThresholds,
+    ModelSection_StateTimerThresholds,
+    ModelSection_InputReaders,
+    ModelSection_InputReadersTransitions,
+    ModelSection_StateWatchers,
+    ModelSection_StateWatchersTransitions,
+    ModelSection_StateTimerReaders,
+    ModelSection_StateTimerReadersTransitions,
+    ModelSection_TimedStates,
+    ModelSection_VolatileTransitions,
+    ModelSection_InitialStates,
+    ModelSection_DeclaredTransitions,
+    // NOTE(nox): Bytecode of the conditions and actions (bytecode.h) and the offset of the
+    // program of every transition and state
+    ModelSection_ConditionCode,
+    ModelSection_ConditionOffsets,
+    ModelSection_ActionCode,
+    ModelSection_ActionOffsets,
+    // NOTE(nox): uint32_t offsets into Strings, with 0 (an empty name) for unused ids; the keys
+    // are one byte per input
+    ModelSection_StateNames,
+    ModelSection_TransitionNames,
+    ModelSection_InputNames,
+    ModelSection_InputKeys,
+    ModelSection_OutputNames,
+    ModelSection_Strings,
+
+    ModelSection_Count
+} model_section;
+
+typedef struct {
+    uint64_t Offset;
+    uint64_t Size;
+} model_section_entry;
+
+// NOTE(nox): Elements of the sections, laid out like the engine's grafcet, state_mask,
+// dependency_list and timer_threshold
+typedef struct {
+    uint32_t FirstState;
+    uint32_t StateCount;
+    uint32_t FirstTransition;
+    uint32_t TransitionCount;
+} model_grafcet;
+
+typedef struct {
+    uint32_t FirstWord;
+    uint32_t WordCount;
+    uint32_t Offset;
+} model_state_mask;
+
+typedef struct {
+    uint32_t Offset;
+    uint32_t Count;
+} model_dependency_list;
+
+typedef struct {
+    uint32_t State;
+    uint32_t Transition;
+    uint32_t Grafcet;
+    uint32_t Milliseconds;
+} model_timer_threshold;
+
+typedef struct {
+    uint32_t Magic;
+    uint32_t Version;
+    uint64_t TopologyHash;
+    // NOTE(nox): Hash of the text of the conditions and actions; when it is not the one of the
+    // engine's compiled functions, only their bytecode can run them
+    uint64_t BehaviourHash;
+    uint32_t GrafcetCount;
+    uint32_t GrafcetLevelCount;
+    uint32_t StateCount;
+    uint32_t TransitionCount;
+    uint32_t TimerThresholdCount;
+    uint32_t InputCount;
+    uint32_t OutputCount;
+    // NOTE(nox): Conditions and actions the bytecode leaves to the compiled functions
+    uint32_t NativeCodeCount;
+    // NOTE(nox): FNV-1a of the 64 bit words after the header
+    uint64_t Checksum;
+    model_section_entry Sections[ModelSection_Count];
+} model_file_header;
+
+// NOTE(nox): Writing, for the preprocessor: sections are appended to one buffer, each one
+// whole or an element at a time while it is the last one, and the file is renamed into place
+// once complete. A section never added is written empty.
+static uint64_t modelChecksum(const uint8_t *Data, uint64_t Size) {
+    uint64_t Hash = 14695981039346656037ull;
+    for(uint64_t Offset = 0; Offset < Size; Offset += 8) {
+        uint64_t Word;
+        memcpy(&Word, Data + Offset, 8);
+        Hash = (Hash ^ Word)*1099511628211ull;
+    }
+    return Hash;
+}
+
+typedef struct {
+    model_file_header Header;
+    uint8_t *Data;
+    uint64_t Size;
+    uint64_t Capacity;
+    int LastSection;
+} model_file_writer;
+
+static void appendModelData(model_file_writer *Writer, const void *Data, uint64_t Size) {
+    if(Writer->Size + Size > Writer->Capacity) {
+        Writer->Capacity = 2*(Writer->Size + Size) + 4096;
+        Writer->Data = realloc(Writer->Data, Writer->Capacity);
+    }
+    memcpy(Writer->Data + Writer->Size, Data, Size);
+    Writer->Size += Size;
+}
+
+static void alignModelData(model_file_writer *Writer) {
+    static const uint8_t Padding[8] = {0};
+    appendModelData(Writer, Padding, (8 - Writer->Size % 8) % 8);
+}
+
+static void beginModelSection(model_file_writer *Writer, model_section Section) {
+    alignModelData(Writer);
+    Writer->Header.Sections[Section].Offset = sizeof(model_file_header) + Writer->Size;
+    Writer->Header.Sections[Section].Size = 0;
+    Writer->LastSection = Section;
+}
+
+static void addModelSectionElement(model_file_writer *Writer, model_section Section, const void *Data, uint64_t Size) {
+    if(!Writer->Header.Sections[Section].Offset) {
+        beginModelSection(Writer, Section);
+    }
+    assert(Writer->LastSection == (int)Section);
+    appendModelData(Writer, Data, Size);
+    Writer->Header.Sections[Section].Size += Size;
+}
+
+static void addModelSection(model_file_writer *Writer, model_section Section, const void *Data, uint64_t Size) {
+    beginModelSection(Writer, Section);
+    addModelSectionElement(Writer, Section, Data, Size);
+}
+
+static bool writeModelFile(model_file_writer *Writer, const char *Path) {
+    char TemporaryPath[4096];
+    if(snprintf(TemporaryPath, sizeof(TemporaryPath), "%s.tmp", Path) >= (int)sizeof(TemporaryPath)) {
+        return false;
+    }
+    Writer->Header.Magic = MODEL_FILE_MAGIC;
+    Writer->Header.Version = MODEL_FILE_VERSION;
+    for(int Section = 0; Section < ModelSection_Count; ++Section) {
+        if(!Writer->Header.Sections[Section].Offset) {
+            beginModelSection(Writer, (model_section)Section);
+        }
+    }
+    alignModelData(Writer);
+    Writer->Header.Checksum = modelChecksum(Writer->Data, Writer->Size);
+
+    FILE *File = fopen(TemporaryPath, "wb");
+    if(!File) {
+        return false;
+    }
+    bool Written = (fwrite(&Writer->Header, sizeof(Writer->Header), 1, File) == 1 &&
+                    fwrite(Writer->Data, 1, Writer->Size, File) == Writer->Size);
+    Written = (fclose(File) == 0) && Written;
+    if(!Written || rename(TemporaryPath, Path) != 0) {
+        unlink(TemporaryPath);
+        return false;
+    }
+    return true;
+}
+
+// NOTE(nox): Reading: the file is mapped read-only, its checksum verified and every section
+// checked to lie inside it; what the sections hold is for the engine to check against what it
+// expects
+typedef struct {
+    void *Map;
+    size_t Size;
+    const model_file_header *Header;
+} model_file;
+
+static bool openModelFile(model_file *File, const char *Path) {
+    memset(File, 0, sizeof(*File));
+    int Fd = open(Path, O_RDONLY);
+    if(Fd < 0) {
+        return false;
+    }
+    struct stat Stat;
+    if(fstat(Fd, &Stat) == 0 && Stat.st_size >= (off_t)sizeof(model_file_header)) {
+        File->Size = (size_t)Stat.st_size;
+        File->Map = mmap(0, File->Size, PROT_READ, MAP_PRIVATE, Fd, 0);
+    }
+    close(Fd);
+    if(!File->Map || File->Map == MAP_FAILED) {
+        File->Map = 0;
+        return false;
+    }
+
+    const model_file_header *Header = File->Header = (const model_file_header *)File->Map;
+    uint64_t DataSize = File->Size - sizeof(model_file_header);
+    if(Header->Magic != MODEL_FILE_MAGIC || Header->Version != MODEL_FILE_VERSION || DataSize % 8 ||
+       Header->Checksum != modelChecksum((const uint8_t *)File->Map + sizeof(model_file_header), DataSize)) {
+        return false;
+    }
+    for(int Section = 0; Section < ModelSection_Count; ++Section) {
+        model_section_entry Entry = Header->Sections[Section];
+        if(Entry.Offset % 8 || Entry.Offset < sizeof(model_file_header) || Entry.Offset > File->Size ||
+           Entry.Size > File->Size - Entry.Offset) {
+            return false;
+        }
+    }
+    const char *Strings = (const char *)File->Map + Header->Sections[ModelSection_Strings].Offset;
+    uint64_t StringsSize = Header->Sections[ModelSection_Strings].Size;
+    return StringsSize > 0 && Strings[0] == 0 && Strings[StringsSize - 1] == 0;
+}
+
+static void closeModelFile(model_file *File) {
+    if(File->Map) {
+        munmap(File->Map, File->Size);
+    }
+    memset(File, 0, sizeof(*File));
+}
+
+// NOTE(nox): Start of a section holding Count elements of ElementSize bytes, or 0 when its size
+// is any other
+static const void *modelSection(model_file *File, model_section Section, uint64_t Count, uint64_t ElementSize) {
+    model_section_entry Entry = File->Header->Sections[Section];
+    return Entry.Size == Count*ElementSize ? (const uint8_t *)File->Map + Entry.Offset : 0;
+}
+
+#define modelSectionCount(File, Section, ElementSize) ((File)->Header->Sections[Section].Size/(ElementSize))
+
+// NOTE(nox): Name of entry Index of a names section; the offsets were checked by the caller
+static const char *modelName(model_file *File, const uint32_t *Names, uint32_t Index) {
+    return (const char *)File->Map + File->Header->Sections[ModelSection_Strings].Offset + Names[Index];
+}
+
+#endif
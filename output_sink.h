@@ -0,0 +1,115 @@
+// -------------------------
+// Generic Grafcet Framework - Output sinks
+// -------------------------
+
+// MIT License:
+//
+// Copyright 2018 Gonçalo Santos
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+
+#if !defined(OUTPUT_SINK_H)
+#define OUTPUT_SINK_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+// NOTE(nox): The outputs that changed in a cycle are handed to every registered sink in one
+// batch, so drivers and loggers only work when something changes. A sink is a callback, or a
+// file descriptor (file, pipe or FIFO) that receives the changes as binary output_change records.
+typedef struct {
+    uint64_t Time;
+    uint32_t Output;
+    uint32_t Value;
+} output_change;
+
+typedef struct output_sink output_sink;
+
+#define OUTPUT_SINK_FUNCTION(Name) void Name(output_sink *Sink, const output_change *Changes, int Count)
+typedef OUTPUT_SINK_FUNCTION(output_sink_function);
+
+struct output_sink {
+    output_sink_function *Write;
+    int Fd;
+    void *Data;
+    uint64_t Dropped;
+};
+
+#define MAX_OUTPUT_SINKS 8
+
+typedef struct {
+    int Count;
+    output_sink Sinks[MAX_OUTPUT_SINKS];
+} output_sinks;
+
+// NOTE(nox): The descriptor is non-blocking, so a slow reader costs changes, counted in Dropped,
+// rather than scan time. Writes are at most PIPE_BUF bytes, which a pipe takes whole or not at all,
+// so a reader never sees part of a record.
+#define OUTPUT_CHANGES_PER_WRITE (PIPE_BUF/sizeof(output_change))
+
+static OUTPUT_SINK_FUNCTION(writeOutputChanges) {
+    for(int First = 0; First < Count;) {
+        int Chunk = Count - First < (int)OUTPUT_CHANGES_PER_WRITE ? Count - First : (int)OUTPUT_CHANGES_PER_WRITE;
+        ssize_t Written = write(Sink->Fd, Changes + First, Chunk*sizeof(output_change));
+        if(Written < 0 && errno == EINTR) {
+            continue;
+        }
+        if(Written != (ssize_t)(Chunk*sizeof(output_change))) {
+            Sink->Dropped += Count - First;
+            break;
+        }
+        First += Chunk;
+    }
+}
+
+static output_sink *addOutputSink(output_sinks *Sinks, output_sink_function *Write, void *Data) {
+    if(Sinks->Count == MAX_OUTPUT_SINKS) {
+        return 0;
+    }
+    output_sink *Sink = Sinks->Sinks + Sinks->Count++;
+    Sink->Write = Write;
+    Sink->Fd = -1;
+    Sink->Data = Data;
+    Sink->Dropped = 0;
+    return Sink;
+}
+
+static output_sink *addOutputFd(output_sinks *Sinks, int Fd) {
+    int Flags = fcntl(Fd, F_GETFL);
+    if(Flags < 0 || fcntl(Fd, F_SETFL, Flags | O_NONBLOCK) != 0) {
+        return 0;
+    }
+    output_sink *Sink = addOutputSink(Sinks, writeOutputChanges, 0);
+    if(Sink) {
+        Sink->Fd = Fd;
+    }
+    return Sink;
+}
+
+static void dispatchOutputChanges(output_sinks *Sinks, const output_change *Changes, int Count) {
+    for(int Index = 0; Index < Sinks->Count; ++Index) {
+        Sinks->Sinks[Index].Write(Sinks->Sinks + Index, Changes, Count);
+    }
+}
+
+#endif
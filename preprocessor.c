@@ -24,9 +24,13 @@
 
 #include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "bytecode.h"
+#include "model_file.h"
 #include "stretchy_buffer.h"
 
 #define ArrayCount(arr) ((sizeof(arr))/sizeof(*arr))
@@ -288,16 +292,273 @@ void parseBraces(tokenizer *Tokenizer) {
     }
 }
 
-static char **States = 0;
-static char **Transitions = 0;
+typedef struct {
+    char *Name;
+    int Grafcet;
+    int Id;
+    bool Initial;
+    char *Output;
+} state_info;
+
+typedef struct {
+    char *Name;
+    int Grafcet;
+    int Id;
+    char **PreviousStates;
+    char **NextStates;
+    int *PreviousIds;
+    int *NextIds;
+    char *Condition;
+
+    // NOTE(nox): What the condition reads; Volatile when it uses anything else. Timers compared
+    // against constants go to Thresholds (ms after the activation of ThresholdStates), the
+    // others to TimerReads and are polled while their state is active.
+    char **InputReads;
+    char **ActiveReads;
+    char **TimerReads;
+    char **ThresholdStates;
+    int *Thresholds;
+    bool Volatile;
+} transition_info;
+
+typedef struct {
+    int State;
+    int Transition;
+    int Milliseconds;
+} timer_threshold_info;
+
+static state_info *States = 0;
+static transition_info *Transitions = 0;
 
 typedef struct {
     char *Start, *End;
 } argument;
 
+static char *copyArgument(argument Argument) {
+    size_t Length = Argument.End - Argument.Start;
+    char *Result = malloc(Length + 1);
+    memcpy(Result, Argument.Start, Length);
+    Result[Length] = 0;
+    return Result;
+}
+
+// NOTE(nox): #define inputMacro(W) W(Name, 'k'), ... and outputMacro(W) W(Name), ... give the
+// inputs and outputs in the order of the engine's arrays, for the tables of the binary model
+static char **InputNames = 0;
+static char *InputKeys = 0;
+static char **OutputNames = 0;
+
+// NOTE(nox): grafcetPeriod(Grafcet, Milliseconds) declarations; grafcets without one are
+// scanned every cycle
+typedef struct {
+    int Grafcet;
+    int Milliseconds;
+} grafcet_period_info;
+
+static grafcet_period_info *GrafcetPeriodInfos = 0;
+
+static void parseIoMacro(tokenizer *Tokenizer, char ***Names, char **Keys) {
+    char *At = Tokenizer->At;
+    while(*At && *At != ')' && !isEndOfLine(*At)) {
+        ++At;
+    }
+    if(*At == ')') {
+        ++At;
+    }
+    while(*At && !isEndOfLine(*At)) {
+        if(*At == '\\') {
+            for(++At; isEndOfLine(*At); ++At) {
+            }
+        } else if(*At == '(') {
+            for(++At; *At == ' ' || *At == '\t'; ++At) {
+            }
+            argument Name = {At, At};
+            while(isAlpha(*Name.End) || isNumber(*Name.End) || *Name.End == '_') {
+                ++Name.End;
+            }
+            sb_push(*Names, copyArgument(Name));
+            char Key = 0;
+            for(At = Name.End; *At && *At != ')' && !isEndOfLine(*At); ++At) {
+                if(At[0] == '\'' && At[1] && At[2] == '\'') {
+                    Key = At[1];
+                    At += 2;
+                }
+            }
+            if(Keys) {
+                sb_push(*Keys, Key);
+            }
+        } else {
+            ++At;
+        }
+    }
+    Tokenizer->At = At;
+}
+
+static int parseNonNegativeLiteral(argument Argument, char *What) {
+    char *End;
+    long Result = strtol(Argument.Start, &End, 10);
+    while(End < Argument.End && isWhitespace(*End)) {
+        ++End;
+    }
+    if(End != Argument.End || Result < 0 || Result > INT32_MAX) {
+        fprintf(stderr, "Syntax error: %s must be a non-negative integer literal (%.*s).\n", What,
+                (int)(Argument.End - Argument.Start), Argument.Start);
+        Result = 0;
+    }
+    return (int)Result;
+}
+
+static int parseGrafcetIndex(argument Argument) {
+    return parseNonNegativeLiteral(Argument, "Grafcet index");
+}
+
+// NOTE(nox): Returns the state names (without the State_ prefix) listed in an ARR(...) argument
+static char **parseStateList(argument Argument) {
+    char **Result = 0;
+    char *Text = copyArgument(Argument);
+    tokenizer Tokenizer = {Text};
+    for(;;) {
+        token Token = getToken(&Tokenizer);
+        if(Token.Type == Token_EndOfStream) {
+            break;
+        }
+        if(Token.Type == Token_Identifier && !tokenEquals(Token, "ARR")) {
+            char Prefix[] = "State_";
+            size_t PrefixLength = sizeof(Prefix) - 1;
+            if(Token.TextLength > PrefixLength && strncmp(Token.Text, Prefix, PrefixLength) == 0) {
+                char *Name = calloc(1, Token.TextLength - PrefixLength + 1);
+                memcpy(Name, Token.Text + PrefixLength, Token.TextLength - PrefixLength);
+                sb_push(Result, Name);
+            } else {
+                fprintf(stderr, "Syntax error: Expected a state id, got %.*s.\n", (int)Token.TextLength, Token.Text);
+            }
+        }
+    }
+    free(Text);
+    return Result;
+}
+
+// NOTE(nox): Returns the text inside the parentheses that follow a macro name, trimmed
+static char *parseMacroArgument(tokenizer *Tokenizer) {
+    char *Result = 0;
+    if(requireToken(Tokenizer, Token_OpenParen)) {
+        eatAllWhitespace(Tokenizer);
+        char *Start = Tokenizer->At;
+        while(Tokenizer->At[0] && Tokenizer->At[0] != ')') {
+            ++Tokenizer->At;
+        }
+        char *End = Tokenizer->At;
+        while(End > Start && isWhitespace(End[-1])) {
+            --End;
+        }
+        if(Tokenizer->At[0]) {
+            ++Tokenizer->At;
+        }
+        Result = calloc(1, End - Start + 1);
+        memcpy(Result, Start, End - Start);
+    }
+    return Result;
+}
+
+// NOTE(nox): Recognizes "timer(X) op N" with an integer N, where the comparison stands on its
+// own (not inside arithmetic). Stores the times (ms after activation) at which it can change.
+static bool parseTimerThreshold(char *Text, char *TimerStart, tokenizer *Tokenizer, int *Thresholds) {
+    char *Before = TimerStart;
+    while(Before > Text && isWhitespace(Before[-1])) {
+        --Before;
+    }
+    if(Before > Text && !(Before[-1] == '(' || Before[-1] == '&' || Before[-1] == '|' ||
+                          Before[-1] == '?' || Before[-1] == ':')) {
+        return false;
+    }
+
+    char *At = Tokenizer->At;
+    while(isWhitespace(*At)) {
+        ++At;
+    }
+    char *Operators[] = {">=", "<=", "==", "!=", ">", "<"};
+    int Operator = -1;
+    for(int Index = 0; Index < ArrayCount(Operators); ++Index) {
+        if(strncmp(At, Operators[Index], strlen(Operators[Index])) == 0) {
+            Operator = Index;
+            At += strlen(Operators[Index]);
+            break;
+        }
+    }
+    if(Operator < 0) {
+        return false;
+    }
+    while(isWhitespace(*At)) {
+        ++At;
+    }
+    if(!isNumber(*At)) {
+        return false;
+    }
+    char *End;
+    long Value = strtol(At, &End, 10);
+    while(isWhitespace(*End)) {
+        ++End;
+    }
+    if(!(*End == 0 || *End == ')' || *End == '&' || *End == '|' || *End == '?' || *End == ':')) {
+        return false;
+    }
+    Tokenizer->At = End;
+
+    // NOTE(nox): timer() is in whole milliseconds, so ">= N" and "< N" change at N, while
+    // "> N" and "<= N" change at N + 1
+    switch(Operator) {
+        case 0: case 5: { Thresholds[0] = Thresholds[1] = (int)Value; } break;
+        case 1: case 4: { Thresholds[0] = Thresholds[1] = (int)Value + 1; } break;
+        default: { Thresholds[0] = (int)Value; Thresholds[1] = (int)Value + 1; } break;
+    }
+    return true;
+}
+
+static void parseConditionDependencies(argument Argument, transition_info *Transition) {
+    char *Text = copyArgument(Argument);
+    tokenizer Tokenizer = {Text};
+    for(;;) {
+        token Token = getToken(&Tokenizer);
+        if(Token.Type == Token_EndOfStream) {
+            break;
+        }
+        if(Token.Type != Token_Identifier) {
+            continue;
+        }
+
+        if(tokenEquals(Token, "input") || tokenEquals(Token, "RE") || tokenEquals(Token, "FE")) {
+            char *Label = parseMacroArgument(&Tokenizer);
+            if(Label) sb_push(Transition->InputReads, Label);
+        } else if(tokenEquals(Token, "active") || tokenEquals(Token, "timer")) {
+            char *Argument = parseMacroArgument(&Tokenizer);
+            if(Argument) {
+                char *Name = calloc(1, strlen(Argument) + 2);
+                sprintf(Name, "X%s", Argument);
+                free(Argument);
+                int Thresholds[2];
+                if(tokenEquals(Token, "active")) {
+                    sb_push(Transition->ActiveReads, Name);
+                } else if(parseTimerThreshold(Text, Token.Text, &Tokenizer, Thresholds)) {
+                    for(int Index = 0; Index < 1 + (Thresholds[1] != Thresholds[0]); ++Index) {
+                        sb_push(Transition->ThresholdStates, Name);
+                        sb_push(Transition->Thresholds, Thresholds[Index]);
+                    }
+                } else {
+                    sb_push(Transition->TimerReads, Name);
+                }
+            }
+        } else if(!tokenEquals(Token, "true") && !tokenEquals(Token, "false")) {
+            Transition->Volatile = true;
+        }
+    }
+    free(Text);
+}
+
 typedef enum {
     Function_NewState,
+    Function_NewInitialState,
     Function_NewTransition,
+    Function_GrafcetPeriod,
 } function_type;
 
 void parseFunction(tokenizer *Tokenizer, function_type Type) {
@@ -345,12 +606,16 @@ void parseFunction(tokenizer *Tokenizer, function_type Type) {
 
         switch(Type) {
             case Function_NewState:
+            case Function_NewInitialState:
             {
                 if(NumberOfArguments == 3) {
                     enum { OutputIndex = 2 };
-                    char *Name = calloc(1, Arguments[1].End - Arguments[1].Start + 1);
+                    char *Name = calloc(1, Arguments[1].End - Arguments[1].Start + 2);
                     sprintf(Name, "X%.*s", Arguments[1].End - Arguments[1].Start, Arguments[1].Start);
-                    sb_push(States, Name);
+                    state_info State = {Name, parseGrafcetIndex(Arguments[0])};
+                    State.Initial = (Type == Function_NewInitialState);
+                    State.Output = copyArgument(Arguments[OutputIndex]);
+                    sb_push(States, State);
 
                     printf("STATE_OUTPUT_FUNCTION(stateAction_%s) %.*s\n",
                            Name,
@@ -366,7 +631,12 @@ void parseFunction(tokenizer *Tokenizer, function_type Type) {
                 if(NumberOfArguments == 5) {
                     char *Name = calloc(1, Arguments[1].End - Arguments[1].Start + 1);
                     sprintf(Name, "%.*s", Arguments[1].End - Arguments[1].Start, Arguments[1].Start);
-                    sb_push(Transitions, Name);
+                    transition_info Transition = {Name, parseGrafcetIndex(Arguments[0])};
+                    Transition.PreviousStates = parseStateList(Arguments[2]);
+                    Transition.NextStates = parseStateList(Arguments[3]);
+                    parseConditionDependencies(Arguments[4], &Transition);
+                    Transition.Condition = copyArgument(Arguments[4]);
+                    sb_push(Transitions, Transition);
 
                     printf("TRANSITION_CONDITION_FUNCTION(transitionCondition_%s) { return (%.*s); }\n",
                            Name,
@@ -375,18 +645,1366 @@ void parseFunction(tokenizer *Tokenizer, function_type Type) {
                     fprintf(stderr, "Syntax error: Incorrect number of arguments to newTransition.\n");
                 }
             } break;
+
+            case Function_GrafcetPeriod:
+            {
+                if(NumberOfArguments == 2) {
+                    grafcet_period_info Period = {parseGrafcetIndex(Arguments[0]),
+                                                  parseNonNegativeLiteral(Arguments[1], "Grafcet period")};
+                    sb_push(GrafcetPeriodInfos, Period);
+                } else {
+                    fprintf(stderr, "Syntax error: Incorrect number of arguments to grafcetPeriod.\n");
+                }
+            } break;
         }
     } else {
         fprintf(stderr, "Syntax error: Missing parentheses.\n");
     }
 }
 
+// NOTE(nox): Open addressing name -> id table, so that big models don't resolve names quadratically
+typedef struct {
+    char *Name;
+    int Id;
+} name_entry;
+
+typedef struct {
+    int Capacity;
+    int Count;
+    name_entry *Entries;
+} name_table;
+
+static uint32_t hashName(char *Name) {
+    uint32_t Hash = 2166136261u;
+    for(; *Name; ++Name) {
+        Hash = (Hash ^ (uint8_t)*Name)*16777619u;
+    }
+    return Hash;
+}
+
+static void insertName(name_table *Table, char *Name, int Id) {
+    if(2*(Table->Count + 1) > Table->Capacity) {
+        name_table Grown = {Table->Capacity ? 2*Table->Capacity : 64};
+        Grown.Entries = calloc(Grown.Capacity, sizeof(name_entry));
+        for(int I = 0; I < Table->Capacity; ++I) {
+            if(Table->Entries[I].Name) {
+                insertName(&Grown, Table->Entries[I].Name, Table->Entries[I].Id);
+            }
+        }
+        free(Table->Entries);
+        *Table = Grown;
+    }
+
+    uint32_t Mask = Table->Capacity - 1;
+    for(uint32_t Slot = hashName(Name) & Mask;; Slot = (Slot + 1) & Mask) {
+        if(!Table->Entries[Slot].Name) {
+            Table->Entries[Slot].Name = Name;
+            Table->Entries[Slot].Id = Id;
+            ++Table->Count;
+            break;
+        } else if(strcmp(Table->Entries[Slot].Name, Name) == 0) {
+            fprintf(stderr, "Error: %s declared more than once.\n", Name);
+            break;
+        }
+    }
+}
+
+static int findName(name_table *Table, char *Name) {
+    if(!Table->Capacity) {
+        return -1;
+    }
+    uint32_t Mask = Table->Capacity - 1;
+    for(uint32_t Slot = hashName(Name) & Mask; Table->Entries[Slot].Name; Slot = (Slot + 1) & Mask) {
+        if(strcmp(Table->Entries[Slot].Name, Name) == 0) {
+            return Table->Entries[Slot].Id;
+        }
+    }
+    return -1;
+}
+
+// NOTE(nox): States and transitions are numbered grafcet by grafcet, and every grafcet starts on
+// a fresh 64-bit word of the state and transition bitsets. This way a grafcet owns contiguous id
+// ranges, needs no membership lists and never shares bitset words with another grafcet.
+static int GrafcetCount = 0;
+static int StateSlotCount = 0;
+static int TransitionSlotCount = 0;
+static int *GrafcetStateStarts = 0;
+static int *GrafcetTransitionStarts = 0;
+static int *StateSlots = 0;
+static int *TransitionSlots = 0;
+static name_table StateIds = {};
+
+static int alignToWord(int Count) {
+    return (Count + 63)/64*64;
+}
+
+static void layoutModel() {
+    for(int I = 0; I < sb_count(States); ++I) {
+        if(States[I].Grafcet >= GrafcetCount) GrafcetCount = States[I].Grafcet + 1;
+    }
+    for(int I = 0; I < sb_count(Transitions); ++I) {
+        if(Transitions[I].Grafcet >= GrafcetCount) GrafcetCount = Transitions[I].Grafcet + 1;
+    }
+
+    int *StateCounts = calloc(GrafcetCount + 1, sizeof(int));
+    int *TransitionCounts = calloc(GrafcetCount + 1, sizeof(int));
+    for(int I = 0; I < sb_count(States); ++I) {
+        ++StateCounts[States[I].Grafcet];
+    }
+    for(int I = 0; I < sb_count(Transitions); ++I) {
+        ++TransitionCounts[Transitions[I].Grafcet];
+    }
+
+    GrafcetStateStarts = calloc(GrafcetCount + 1, sizeof(int));
+    GrafcetTransitionStarts = calloc(GrafcetCount + 1, sizeof(int));
+    for(int Grafcet = 0; Grafcet < GrafcetCount; ++Grafcet) {
+        GrafcetStateStarts[Grafcet + 1] = GrafcetStateStarts[Grafcet] + alignToWord(StateCounts[Grafcet]);
+        GrafcetTransitionStarts[Grafcet + 1] = (GrafcetTransitionStarts[Grafcet] +
+                                                alignToWord(TransitionCounts[Grafcet]));
+    }
+    StateSlotCount = GrafcetStateStarts[GrafcetCount];
+    TransitionSlotCount = GrafcetTransitionStarts[GrafcetCount];
+
+    // NOTE(nox): Declaration order is kept inside each grafcet
+    StateSlots = malloc((StateSlotCount + 1)*sizeof(int));
+    TransitionSlots = malloc((TransitionSlotCount + 1)*sizeof(int));
+    memset(StateSlots, -1, (StateSlotCount + 1)*sizeof(int));
+    memset(TransitionSlots, -1, (TransitionSlotCount + 1)*sizeof(int));
+    memset(StateCounts, 0, (GrafcetCount + 1)*sizeof(int));
+    memset(TransitionCounts, 0, (GrafcetCount + 1)*sizeof(int));
+    for(int I = 0; I < sb_count(States); ++I) {
+        int Grafcet = States[I].Grafcet;
+        States[I].Id = GrafcetStateStarts[Grafcet] + StateCounts[Grafcet]++;
+        StateSlots[States[I].Id] = I;
+        insertName(&StateIds, States[I].Name, I);
+    }
+    for(int I = 0; I < sb_count(Transitions); ++I) {
+        int Grafcet = Transitions[I].Grafcet;
+        Transitions[I].Id = GrafcetTransitionStarts[Grafcet] + TransitionCounts[Grafcet]++;
+        TransitionSlots[Transitions[I].Id] = I;
+    }
+
+    for(int I = 0; I < sb_count(Transitions); ++I) {
+        transition_info *Transition = Transitions + I;
+        char **Lists[] = {Transition->PreviousStates, Transition->NextStates};
+        int **Ids[] = {&Transition->PreviousIds, &Transition->NextIds};
+        for(int ListIndex = 0; ListIndex < ArrayCount(Lists); ++ListIndex) {
+            for(int Index = 0; Index < sb_count(Lists[ListIndex]); ++Index) {
+                char *Name = Lists[ListIndex][Index];
+                int State = findName(&StateIds, Name);
+                if(State < 0) {
+                    fprintf(stderr, "Error: Transition %s references undeclared state %s.\n",
+                            Transition->Name, Name);
+                    continue;
+                } else if(States[State].Grafcet != Transition->Grafcet) {
+                    fprintf(stderr, "Warning: Transition %s links state %s from another grafcet.\n",
+                            Transition->Name, Name);
+                }
+                sb_push(*Ids[ListIndex], States[State].Id);
+            }
+        }
+    }
+
+    free(StateCounts);
+    free(TransitionCounts);
+}
+
+// NOTE(nox): Appends to Words the bitset words spanned by the state Ids, returning the first one
+static int appendMask(int *Ids, uint64_t **Words) {
+    int FirstWord = 0, WordCount = 0;
+    if(sb_count(Ids)) {
+        int LastWord = FirstWord = Ids[0]/64;
+        for(int Index = 1; Index < sb_count(Ids); ++Index) {
+            if(Ids[Index]/64 < FirstWord) FirstWord = Ids[Index]/64;
+            if(Ids[Index]/64 > LastWord) LastWord = Ids[Index]/64;
+        }
+        WordCount = LastWord - FirstWord + 1;
+    }
+    uint64_t *Mask = sb_add(*Words, WordCount);
+    memset(Mask, 0, WordCount*sizeof(uint64_t));
+    for(int Index = 0; Index < sb_count(Ids); ++Index) {
+        Mask[Ids[Index]/64 - FirstWord] |= 1ull << (Ids[Index] % 64);
+    }
+    return FirstWord;
+}
+
+// NOTE(nox): The binary model (--model-file) gets the tables of emitTopology as they are
+// emitted, indexed by id like the C arrays
+static model_file_writer ModelFile;
+
+// NOTE(nox): Emits Lists[Key] (transition ids) as one packed array plus a table of
+// {Offset, Count} entries, using designated initializers so keys can be enum names. The binary
+// model gets the same table, of TableSize entries with key Key at KeyIds[Key].
+static void emitDependencyTable(char *Name, char *Size, char **Keys, int **Lists, int KeyCount, int *KeyIds,
+                                int TableSize, model_section Section) {
+    int Total = 0;
+    for(int Key = 0; Key < KeyCount; ++Key) {
+        Total += sb_count(Lists[Key]);
+    }
+
+    uint32_t *Packed = calloc(Total + 1, sizeof(uint32_t));
+    model_dependency_list *Table = calloc(TableSize + 1, sizeof(model_dependency_list));
+    for(int Key = 0, Offset = 0; Key < KeyCount; ++Key) {
+        if(KeyIds[Key] >= 0 && KeyIds[Key] < TableSize) {
+            Table[KeyIds[Key]] = (model_dependency_list){(uint32_t)Offset, (uint32_t)sb_count(Lists[Key])};
+        }
+        for(int Index = 0; Index < sb_count(Lists[Key]); ++Index) {
+            Packed[Offset++] = Transitions[Lists[Key][Index]].Id;
+        }
+    }
+    addModelSection(&ModelFile, Section, Table, TableSize*sizeof(model_dependency_list));
+    addModelSection(&ModelFile, Section + 1, Packed, Total*sizeof(uint32_t));
+    free(Packed);
+    free(Table);
+
+    printf("\nstatic const transition_id %sTransitions[%d] = {\n", Name, Total ? Total : 1);
+    for(int Key = 0; Key < KeyCount; ++Key) {
+        if(sb_count(Lists[Key])) {
+            printf("   ");
+            for(int Index = 0; Index < sb_count(Lists[Key]); ++Index) {
+                printf(" Transition_%s,", Transitions[Lists[Key][Index]].Name);
+            }
+            printf("\n");
+        }
+    }
+    printf("};\n");
+
+    printf("\nstatic const dependency_list %s[%s] = {\n", Name, Size);
+    int Offset = 0;
+    for(int Key = 0; Key < KeyCount; ++Key) {
+        if(sb_count(Lists[Key])) {
+            printf("    [%s] = {%d, %d},\n", Keys[Key], Offset, sb_count(Lists[Key]));
+            Offset += sb_count(Lists[Key]);
+        }
+    }
+    printf("};\n");
+}
+
+static void pushDependency(int **List, int Transition) {
+    if(!sb_count(*List) || sb_last(*List) != Transition) {
+        sb_push(*List, Transition);
+    }
+}
+
+// NOTE(nox): Hierarchy levels. Two grafcets are related when one reads the states of the other
+// (active(), timer() or a link) or gives it a supervision order; the one with the higher index
+// must then be scanned after the other, as in the sequential order. Two grafcets that give orders
+// to a common grafcet are related as well, so the later order still wins. A grafcet goes one level
+// above the highest related grafcet below it, so the grafcets of a level never touch each other
+// and can be scanned concurrently, with the results of the sequential order.
+static int GrafcetLevelCount = 0;
+static int *GrafcetLevels = 0;
+static bool *RelatedGrafcets = 0;
+static bool *OrderedGrafcets = 0;
+
+static void relateGrafcets(int A, int B) {
+    if(A >= 0 && B >= 0 && A < GrafcetCount && B < GrafcetCount && A != B) {
+        RelatedGrafcets[A*GrafcetCount + B] = RelatedGrafcets[B*GrafcetCount + A] = true;
+    }
+}
+
+static void orderGrafcet(int Issuer, int Target) {
+    relateGrafcets(Issuer, Target);
+    if(Target >= 0 && Target < GrafcetCount) {
+        OrderedGrafcets[Issuer*GrafcetCount + Target] = true;
+    }
+}
+
+static void relateStateGrafcet(int Grafcet, char *StateName) {
+    int State = findName(&StateIds, StateName);
+    if(State >= 0) {
+        relateGrafcets(Grafcet, States[State].Grafcet);
+    }
+}
+
+// NOTE(nox): A supervision order (freeze(), suspend(), resume() or reset()) whose argument is not
+// a constant could reach any grafcet
+static void collectGrafcetReferences(char *Text, int Grafcet) {
+    tokenizer Tokenizer = {Text};
+    for(;;) {
+        token Token = getToken(&Tokenizer);
+        if(Token.Type == Token_EndOfStream) {
+            break;
+        }
+        if(Token.Type != Token_Identifier) {
+            continue;
+        }
+
+        if(tokenEquals(Token, "active") || tokenEquals(Token, "timer")) {
+            char *Argument = parseMacroArgument(&Tokenizer);
+            if(Argument) {
+                char *Name = calloc(1, strlen(Argument) + 2);
+                sprintf(Name, "X%s", Argument);
+                relateStateGrafcet(Grafcet, Name);
+                free(Name);
+                free(Argument);
+            }
+        } else if(tokenEquals(Token, "freeze") || tokenEquals(Token, "suspend") || tokenEquals(Token, "resume") ||
+                  tokenEquals(Token, "reset")) {
+            char *Argument = parseMacroArgument(&Tokenizer);
+            if(Argument) {
+                char *End;
+                long Frozen = strtol(Argument, &End, 10);
+                if(End != Argument && *End == 0) {
+                    orderGrafcet(Grafcet, (int)Frozen);
+                } else {
+                    for(int Other = 0; Other < GrafcetCount; ++Other) {
+                        orderGrafcet(Grafcet, Other);
+                    }
+                }
+                free(Argument);
+            }
+        }
+    }
+}
+
+static void computeGrafcetLevels() {
+    RelatedGrafcets = calloc((size_t)GrafcetCount*GrafcetCount + 1, sizeof(bool));
+    OrderedGrafcets = calloc((size_t)GrafcetCount*GrafcetCount + 1, sizeof(bool));
+    for(int I = 0; I < sb_count(States); ++I) {
+        collectGrafcetReferences(States[I].Output, States[I].Grafcet);
+    }
+    for(int I = 0; I < sb_count(Transitions); ++I) {
+        transition_info *Transition = Transitions + I;
+        collectGrafcetReferences(Transition->Condition, Transition->Grafcet);
+        for(int Index = 0; Index < sb_count(Transition->PreviousStates); ++Index) {
+            relateStateGrafcet(Transition->Grafcet, Transition->PreviousStates[Index]);
+        }
+        for(int Index = 0; Index < sb_count(Transition->NextStates); ++Index) {
+            relateStateGrafcet(Transition->Grafcet, Transition->NextStates[Index]);
+        }
+    }
+    for(int Target = 0; Target < GrafcetCount; ++Target) {
+        for(int A = 0; A < GrafcetCount; ++A) {
+            for(int B = A + 1; OrderedGrafcets[A*GrafcetCount + Target] && B < GrafcetCount; ++B) {
+                if(OrderedGrafcets[B*GrafcetCount + Target]) {
+                    relateGrafcets(A, B);
+                }
+            }
+        }
+    }
+
+    GrafcetLevels = calloc(GrafcetCount + 1, sizeof(int));
+    for(int Grafcet = 0; Grafcet < GrafcetCount; ++Grafcet) {
+        for(int Below = 0; Below < Grafcet; ++Below) {
+            if(RelatedGrafcets[Below*GrafcetCount + Grafcet] && GrafcetLevels[Below] + 1 > GrafcetLevels[Grafcet]) {
+                GrafcetLevels[Grafcet] = GrafcetLevels[Below] + 1;
+            }
+        }
+        if(GrafcetLevels[Grafcet] + 1 > GrafcetLevelCount) {
+            GrafcetLevelCount = GrafcetLevels[Grafcet] + 1;
+        }
+    }
+}
+
+// NOTE(nox): Compiles conditions and actions to the bytecode of bytecode.h with a recursive
+// descent over their text, following the C precedences. A construct it does not know makes the
+// whole condition or action a Native instruction, so the bytecode engine still runs it through
+// the compiled function.
+typedef struct {
+    char *At;
+    uint32_t *Code;
+    int Depth;
+    bool Failed;
+} code_compiler;
+
+static void skipCodeWhitespace(code_compiler *Compiler) {
+    while(isWhitespace(*Compiler->At)) {
+        ++Compiler->At;
+    }
+}
+
+static bool acceptCodeText(code_compiler *Compiler, char *Text) {
+    skipCodeWhitespace(Compiler);
+    size_t Length = strlen(Text);
+    if(strncmp(Compiler->At, Text, Length) != 0) {
+        return false;
+    }
+    // NOTE(nox): A word must not continue, and & or | must not be doubled when they are not
+    // expected so
+    char Next = Compiler->At[Length];
+    if((isAlpha(Text[0]) && (isAlpha(Next) || isNumber(Next) || Next == '_')) ||
+       (Length == 1 && (Text[0] == '<' || Text[0] == '>' || Text[0] == '!') && Next == '=')) {
+        return false;
+    }
+    Compiler->At += Length;
+    return true;
+}
+
+static void emitCodeInstruction(code_compiler *Compiler, code_op Op, uint32_t Operand, int Pops, int Pushes) {
+    if(Operand > CODE_MAX_OPERAND) {
+        Compiler->Failed = true;
+    }
+    Compiler->Depth += Pushes - Pops;
+    if(Compiler->Depth > CODE_STACK_SIZE) {
+        Compiler->Failed = true;
+    }
+    sb_push(Compiler->Code, codeInstruction(Op, Operand & CODE_MAX_OPERAND));
+}
+
+// NOTE(nox): Jumps are emitted with a placeholder and patched once their target is known
+static int emitCodeJump(code_compiler *Compiler, code_op Op, int Pops) {
+    emitCodeInstruction(Compiler, Op, 0, Pops, 0);
+    return sb_count(Compiler->Code) - 1;
+}
+
+static void patchCodeJump(code_compiler *Compiler, int Jump) {
+    Compiler->Code[Jump] |= codeInstruction(0, sb_count(Compiler->Code) - (Jump + 1));
+}
+
+// NOTE(nox): The argument of a macro call: a label, or a number when Number is set
+static char *parseCodeArgument(code_compiler *Compiler, bool Number) {
+    if(!acceptCodeText(Compiler, "(")) {
+        Compiler->Failed = true;
+        return 0;
+    }
+    skipCodeWhitespace(Compiler);
+    char *Start = Compiler->At;
+    while(isAlpha(*Compiler->At) || isNumber(*Compiler->At) || *Compiler->At == '_') {
+        ++Compiler->At;
+    }
+    char *Argument = calloc(1, Compiler->At - Start + 2);
+    memcpy(Argument, Start, Compiler->At - Start);
+    if(Start == Compiler->At || !acceptCodeText(Compiler, ")") || (Number && !isNumber(Start[0]))) {
+        Compiler->Failed = true;
+    }
+    return Argument;
+}
+
+static int findLabel(char **Names, char *Label) {
+    for(int Index = 0; Index < sb_count(Names); ++Index) {
+        if(strcmp(Names[Index], Label) == 0) {
+            return Index;
+        }
+    }
+    return -1;
+}
+
+static uint32_t resolveCodeLabel(code_compiler *Compiler, char **Names, bool State) {
+    char *Argument = parseCodeArgument(Compiler, false);
+    int Id = -1;
+    if(Argument && State) {
+        char *Name = calloc(1, strlen(Argument) + 2);
+        sprintf(Name, "X%s", Argument);
+        int Index = findName(&StateIds, Name);
+        Id = Index < 0 ? -1 : States[Index].Id;
+        free(Name);
+    } else if(Argument) {
+        Id = findLabel(Names, Argument);
+    }
+    free(Argument);
+    if(Id < 0) {
+        Compiler->Failed = true;
+        Id = 0;
+    }
+    return (uint32_t)Id;
+}
+
+static uint32_t parseCodeGrafcet(code_compiler *Compiler) {
+    char *Argument = parseCodeArgument(Compiler, true);
+    uint32_t Grafcet = Argument ? (uint32_t)strtoul(Argument, 0, 10) : 0;
+    free(Argument);
+    if(Grafcet >= (uint32_t)GrafcetCount) {
+        Compiler->Failed = true;
+    }
+    return Grafcet;
+}
+
+static bool compileCodeExpression(code_compiler *Compiler);
+
+// NOTE(nox): The compile functions return whether their value is already 0 or 1
+static bool compileCodePrimary(code_compiler *Compiler) {
+    skipCodeWhitespace(Compiler);
+    if(acceptCodeText(Compiler, "(")) {
+        bool Bool = compileCodeExpression(Compiler);
+        if(!acceptCodeText(Compiler, ")")) {
+            Compiler->Failed = true;
+        }
+        return Bool;
+    } else if(acceptCodeText(Compiler, "input")) {
+        emitCodeInstruction(Compiler, Op_Input, resolveCodeLabel(Compiler, InputNames, false), 0, 1);
+    } else if(acceptCodeText(Compiler, "RE")) {
+        emitCodeInstruction(Compiler, Op_RisingEdge, resolveCodeLabel(Compiler, InputNames, false), 0, 1);
+    } else if(acceptCodeText(Compiler, "FE")) {
+        emitCodeInstruction(Compiler, Op_FallingEdge, resolveCodeLabel(Compiler, InputNames, false), 0, 1);
+    } else if(acceptCodeText(Compiler, "active")) {
+        emitCodeInstruction(Compiler, Op_Active, resolveCodeLabel(Compiler, 0, true), 0, 1);
+    } else if(acceptCodeText(Compiler, "timer")) {
+        emitCodeInstruction(Compiler, Op_Timer, resolveCodeLabel(Compiler, 0, true), 0, 1);
+        return false;
+    } else if(acceptCodeText(Compiler, "true")) {
+        emitCodeInstruction(Compiler, Op_Constant, 1, 0, 1);
+    } else if(acceptCodeText(Compiler, "false")) {
+        emitCodeInstruction(Compiler, Op_Constant, 0, 0, 1);
+    } else if(isNumber(*Compiler->At)) {
+        char *End;
+        unsigned long Value = strtoul(Compiler->At, &End, 10);
+        if(isAlpha(*End) || *End == '_' || *End == '.' || Value > CODE_MAX_OPERAND) {
+            Compiler->Failed = true;
+        }
+        Compiler->At = End;
+        emitCodeInstruction(Compiler, Op_Constant, (uint32_t)Value, 0, 1);
+        return Value <= 1;
+    } else {
+        Compiler->Failed = true;
+    }
+    return true;
+}
+
+static bool compileCodeUnary(code_compiler *Compiler) {
+    if(acceptCodeText(Compiler, "!")) {
+        compileCodeUnary(Compiler);
+        emitCodeInstruction(Compiler, Op_Not, 0, 1, 1);
+        return true;
+    }
+    return compileCodePrimary(Compiler);
+}
+
+typedef struct {
+    char *Text;
+    code_op Op;
+} code_operator;
+
+// NOTE(nox): Left-associative binary operators of one precedence, over operands of the next
+static bool compileCodeBinary(code_compiler *Compiler, code_operator *Operators, int OperatorCount,
+                              bool (*compileOperand)(code_compiler *)) {
+    bool Bool = compileOperand(Compiler);
+    for(int Index = 0; !Compiler->Failed && Index < OperatorCount; ++Index) {
+        if(acceptCodeText(Compiler, Operators[Index].Text)) {
+            compileOperand(Compiler);
+            emitCodeInstruction(Compiler, Operators[Index].Op, 0, 2, 1);
+            Bool = true;
+            Index = -1;
+        }
+    }
+    return Bool;
+}
+
+static bool compileCodeRelational(code_compiler *Compiler) {
+    code_operator Operators[] = {
+        {"<=", Op_LessEqual}, {">=", Op_GreaterEqual}, {"<", Op_Less}, {">", Op_Greater},
+    };
+    return compileCodeBinary(Compiler, Operators, ArrayCount(Operators), compileCodeUnary);
+}
+
+static bool compileCodeEquality(code_compiler *Compiler) {
+    code_operator Operators[] = {{"==", Op_Equal}, {"!=", Op_NotEqual}};
+    return compileCodeBinary(Compiler, Operators, ArrayCount(Operators), compileCodeRelational);
+}
+
+static bool compileCodeLogical(code_compiler *Compiler, bool Or) {
+    bool Bool = Or ? compileCodeLogical(Compiler, false) : compileCodeEquality(Compiler);
+    int *Jumps = 0;
+    while(!Compiler->Failed && acceptCodeText(Compiler, Or ? "||" : "&&")) {
+        if(!Bool) {
+            emitCodeInstruction(Compiler, Op_Bool, 0, 1, 1);
+        }
+        sb_push(Jumps, emitCodeJump(Compiler, Or ? Op_OrJump : Op_AndJump, 1));
+        Bool = Or ? compileCodeLogical(Compiler, false) : compileCodeEquality(Compiler);
+        if(!Bool) {
+            emitCodeInstruction(Compiler, Op_Bool, 0, 1, 1);
+            Bool = true;
+        }
+    }
+    for(int Index = 0; Index < sb_count(Jumps); ++Index) {
+        patchCodeJump(Compiler, Jumps[Index]);
+    }
+    sb_free(Jumps);
+    return Bool;
+}
+
+static bool compileCodeExpression(code_compiler *Compiler) {
+    return compileCodeLogical(Compiler, true);
+}
+
+static void compileCodeStatement(code_compiler *Compiler) {
+    struct { char *Text; code_op Op; } Orders[] = {
+        {"freeze", Op_Freeze}, {"suspend", Op_Suspend}, {"resume", Op_Resume}, {"reset", Op_Reset},
+    };
+    if(acceptCodeText(Compiler, ";")) {
+        return;
+    } else if(acceptCodeText(Compiler, "{")) {
+        while(!Compiler->Failed && !acceptCodeText(Compiler, "}")) {
+            if(!*Compiler->At) {
+                Compiler->Failed = true;
+            }
+            compileCodeStatement(Compiler);
+        }
+        return;
+    } else if(acceptCodeText(Compiler, "if")) {
+        if(!acceptCodeText(Compiler, "(")) {
+            Compiler->Failed = true;
+            return;
+        }
+        compileCodeExpression(Compiler);
+        if(!acceptCodeText(Compiler, ")")) {
+            Compiler->Failed = true;
+        }
+        int Skip = emitCodeJump(Compiler, Op_JumpIfFalse, 1);
+        compileCodeStatement(Compiler);
+        if(acceptCodeText(Compiler, "else")) {
+            int SkipElse = emitCodeJump(Compiler, Op_Jump, 0);
+            patchCodeJump(Compiler, Skip);
+            compileCodeStatement(Compiler);
+            patchCodeJump(Compiler, SkipElse);
+        } else {
+            patchCodeJump(Compiler, Skip);
+        }
+        return;
+    } else if(acceptCodeText(Compiler, "output")) {
+        emitCodeInstruction(Compiler, Op_Output, resolveCodeLabel(Compiler, OutputNames, false), 0, 0);
+    } else {
+        bool Matched = false;
+        for(int Index = 0; !Matched && Index < ArrayCount(Orders); ++Index) {
+            if(acceptCodeText(Compiler, Orders[Index].Text)) {
+                emitCodeInstruction(Compiler, Orders[Index].Op, parseCodeGrafcet(Compiler), 0, 0);
+                Matched = true;
+            }
+        }
+        Compiler->Failed = Compiler->Failed || !Matched;
+    }
+    if(!acceptCodeText(Compiler, ";")) {
+        Compiler->Failed = true;
+    }
+}
+
+// NOTE(nox): Appends the program of a condition (or an action) to Code, returning false when it
+// fell back to the compiled function
+static bool compileCode(uint32_t **Code, char *Text, bool Condition, int Id) {
+    code_compiler Compiler = {Text};
+    if(Condition) {
+        compileCodeExpression(&Compiler);
+        emitCodeInstruction(&Compiler, Op_Return, 0, 1, 0);
+    } else {
+        while(!Compiler.Failed && *Compiler.At) {
+            compileCodeStatement(&Compiler);
+            skipCodeWhitespace(&Compiler);
+        }
+        emitCodeInstruction(&Compiler, Op_End, 0, 0, 0);
+    }
+    skipCodeWhitespace(&Compiler);
+    bool Compiled = !Compiler.Failed && !*Compiler.At;
+    if(!Compiled) {
+        sb_free(Compiler.Code);
+        Compiler.Code = 0;
+        sb_push(Compiler.Code, codeInstruction(Condition ? Op_NativeCondition : Op_NativeAction, Id));
+        if(Condition) {
+            sb_push(Compiler.Code, codeInstruction(Op_Return, 0));
+        } else {
+            sb_push(Compiler.Code, codeInstruction(Op_End, 0));
+        }
+    }
+    for(int Index = 0; Index < sb_count(Compiler.Code); ++Index) {
+        sb_push(*Code, Compiler.Code[Index]);
+    }
+    sb_free(Compiler.Code);
+    return Compiled;
+}
+
+static void emitCodeArray(char *Name, uint32_t *Code) {
+    printf("\nstatic const uint32_t %s[%d] = {", Name, sb_count(Code));
+    for(int Index = 0; Index < sb_count(Code); ++Index) {
+        printf("%s0x%08x,", Index % 8 ? " " : "\n    ", Code[Index]);
+    }
+    printf("\n};\n");
+}
+
+// NOTE(nox): Offset 0 of each array holds the program of the unused ids (false, and nothing)
+static void emitCode() {
+    uint32_t *Code = 0;
+    uint32_t *Offsets = calloc(StateSlotCount + TransitionSlotCount + 1, sizeof(uint32_t));
+    int NativeCount = 0;
+    sb_push(Code, codeInstruction(Op_Constant, 0));
+    sb_push(Code, codeInstruction(Op_Return, 0));
+    for(int Id = 0; Id < TransitionSlotCount; ++Id) {
+        if(TransitionSlots[Id] >= 0) {
+            transition_info *Transition = Transitions + TransitionSlots[Id];
+            Offsets[Id] = sb_count(Code);
+            if(!compileCode(&Code, Transition->Condition, true, Id)) {
+                fprintf(stderr, "Note: The condition of transition %s is not compiled to bytecode.\n",
+                        Transition->Name);
+                ++NativeCount;
+            }
+        }
+    }
+    emitCodeArray("ConditionCode", Code);
+    printf("\nstatic const uint32_t ConditionOffsets[TransitionCount] = {\n");
+    for(int Id = 0; Id < TransitionSlotCount; ++Id) {
+        if(TransitionSlots[Id] >= 0) {
+            printf("    [Transition_%s] = %u,\n", Transitions[TransitionSlots[Id]].Name, Offsets[Id]);
+        }
+    }
+    printf("};\n");
+    addModelSection(&ModelFile, ModelSection_ConditionCode, Code, sb_count(Code)*sizeof(uint32_t));
+    addModelSection(&ModelFile, ModelSection_ConditionOffsets, Offsets, TransitionSlotCount*sizeof(uint32_t));
+
+    sb_free(Code);
+    Code = 0;
+    memset(Offsets, 0, StateSlotCount*sizeof(uint32_t));
+    sb_push(Code, codeInstruction(Op_End, 0));
+    for(int Id = 0; Id < StateSlotCount; ++Id) {
+        if(StateSlots[Id] >= 0) {
+            state_info *State = States + StateSlots[Id];
+            Offsets[Id] = sb_count(Code);
+            if(!compileCode(&Code, State->Output, false, Id)) {
+                fprintf(stderr, "Note: The action of state %s is not compiled to bytecode.\n", State->Name + 1);
+                ++NativeCount;
+            }
+        }
+    }
+    emitCodeArray("ActionCode", Code);
+    printf("\nstatic const uint32_t ActionOffsets[StateCount] = {\n");
+    for(int Id = 0; Id < StateSlotCount; ++Id) {
+        if(StateSlots[Id] >= 0) {
+            printf("    [State_%s] = %u,\n", States[StateSlots[Id]].Name, Offsets[Id]);
+        }
+    }
+    printf("};\n");
+    addModelSection(&ModelFile, ModelSection_ActionCode, Code, sb_count(Code)*sizeof(uint32_t));
+    addModelSection(&ModelFile, ModelSection_ActionOffsets, Offsets, StateSlotCount*sizeof(uint32_t));
+    ModelFile.Header.NativeCodeCount = NativeCount;
+
+    sb_free(Code);
+    free(Offsets);
+}
+
+static void emitTopology() {
+    for(int Id = 0; Id < StateSlotCount; ++Id) {
+        if(StateSlots[Id] >= 0) {
+            printf("STATE_OUTPUT_FUNCTION(stateAction_%s);\n", States[StateSlots[Id]].Name);
+        }
+    }
+    for(int Id = 0; Id < TransitionSlotCount; ++Id) {
+        if(TransitionSlots[Id] >= 0) {
+            printf("TRANSITION_CONDITION_FUNCTION(transitionCondition_%s);\n", Transitions[TransitionSlots[Id]].Name);
+        }
+    }
+
+    // NOTE(nox): The functions are what the scans read, so they get arrays of their own; the names
+    // are only read by the display and the reports. State names are emitted without the X prefix.
+    printf("\nstatic state_output_function *const StateOutputs[StateCount] = {\n");
+    for(int Id = 0; Id < StateSlotCount; ++Id) {
+        if(StateSlots[Id] >= 0) {
+            char *Name = States[StateSlots[Id]].Name;
+            printf("    [State_%s] = stateAction_%s,\n", Name, Name);
+        }
+    }
+    printf("};\n");
+
+    printf("\nstatic transition_condition_function *const TransitionConditions[TransitionCount] = {\n");
+    for(int Id = 0; Id < TransitionSlotCount; ++Id) {
+        if(TransitionSlots[Id] >= 0) {
+            char *Name = Transitions[TransitionSlots[Id]].Name;
+            printf("    [Transition_%s] = transitionCondition_%s,\n", Name, Name);
+        }
+    }
+    printf("};\n");
+
+    printf("\nstatic const char *const StateNames[StateCount] = {\n");
+    for(int Id = 0; Id < StateSlotCount; ++Id) {
+        if(StateSlots[Id] >= 0) {
+            char *Name = States[StateSlots[Id]].Name;
+            printf("    [State_%s] = \"%s\",\n", Name, Name + 1);
+        }
+    }
+    printf("};\n");
+
+    printf("\nstatic const char *const TransitionNames[TransitionCount] = {\n");
+    for(int Id = 0; Id < TransitionSlotCount; ++Id) {
+        if(TransitionSlots[Id] >= 0) {
+            char *Name = Transitions[TransitionSlots[Id]].Name;
+            printf("    [Transition_%s] = \"%s\",\n", Name, Name);
+        }
+    }
+    printf("};\n");
+
+    printf("\nstatic const grafcet Grafcets[GrafcetCount] = {\n");
+    for(int Grafcet = 0; Grafcet < GrafcetCount; ++Grafcet) {
+        int FirstState = GrafcetStateStarts[Grafcet], FirstTransition = GrafcetTransitionStarts[Grafcet];
+        int StateCount = 0, TransitionCount = 0;
+        while(FirstState + StateCount < StateSlotCount && StateSlots[FirstState + StateCount] >= 0 &&
+              States[StateSlots[FirstState + StateCount]].Grafcet == Grafcet) {
+            ++StateCount;
+        }
+        while(FirstTransition + TransitionCount < TransitionSlotCount &&
+              TransitionSlots[FirstTransition + TransitionCount] >= 0 &&
+              Transitions[TransitionSlots[FirstTransition + TransitionCount]].Grafcet == Grafcet) {
+            ++TransitionCount;
+        }
+        printf("    {%d, %d, %d, %d},\n", FirstState, StateCount, FirstTransition, TransitionCount);
+        model_grafcet Entry = {(uint32_t)FirstState, (uint32_t)StateCount, (uint32_t)FirstTransition,
+                               (uint32_t)TransitionCount};
+        addModelSectionElement(&ModelFile, ModelSection_Grafcets, &Entry, sizeof(Entry));
+    }
+    printf("};\n");
+
+    printf("\nstatic const int GrafcetLevelOffsets[GrafcetLevelCount + 1] = {");
+    int LevelOffset = 0;
+    for(int Level = 0; Level <= GrafcetLevelCount; ++Level) {
+        printf(Level < GrafcetLevelCount ? " %d," : " %d };\n", LevelOffset);
+        addModelSectionElement(&ModelFile, ModelSection_GrafcetLevelOffsets, &LevelOffset, sizeof(int));
+        for(int Grafcet = 0; Grafcet < GrafcetCount; ++Grafcet) {
+            LevelOffset += (GrafcetLevels[Grafcet] == Level);
+        }
+    }
+    printf("static const int GrafcetsByLevel[GrafcetCount] = {");
+    for(int Level = 0; Level < GrafcetLevelCount; ++Level) {
+        for(int Grafcet = 0; Grafcet < GrafcetCount; ++Grafcet) {
+            if(GrafcetLevels[Grafcet] == Level) {
+                printf(" %d,", Grafcet);
+                addModelSectionElement(&ModelFile, ModelSection_GrafcetsByLevel, &Grafcet, sizeof(int));
+            }
+        }
+    }
+    printf(" };\n");
+
+    // NOTE(nox): Milliseconds between the scans of every grafcet, 0 for every cycle
+    uint32_t *Periods = calloc(GrafcetCount + 1, sizeof(uint32_t));
+    for(int I = 0; I < sb_count(GrafcetPeriodInfos); ++I) {
+        grafcet_period_info Info = GrafcetPeriodInfos[I];
+        if(Info.Grafcet >= GrafcetCount) {
+            fprintf(stderr, "Error: grafcetPeriod of grafcet %d, which has no states.\n", Info.Grafcet);
+        } else {
+            if(Periods[Info.Grafcet]) {
+                fprintf(stderr, "Error: Period of grafcet %d declared more than once.\n", Info.Grafcet);
+            }
+            Periods[Info.Grafcet] = (uint32_t)Info.Milliseconds;
+        }
+    }
+    printf("static const uint32_t GrafcetPeriods[GrafcetCount] = {");
+    for(int Grafcet = 0; Grafcet < GrafcetCount; ++Grafcet) {
+        printf(" %u,", Periods[Grafcet]);
+    }
+    printf(" };\n");
+    addModelSection(&ModelFile, ModelSection_GrafcetPeriods, Periods, GrafcetCount*sizeof(uint32_t));
+    free(Periods);
+
+    int LinkCount = 0;
+    printf("\nstatic const uint32_t TransitionLinkOffsets[2*TransitionCount + 1] = {\n");
+    for(int Id = 0; Id < TransitionSlotCount; ++Id) {
+        transition_info *Transition = TransitionSlots[Id] >= 0 ? Transitions + TransitionSlots[Id] : 0;
+        printf("    %d, ", LinkCount);
+        addModelSectionElement(&ModelFile, ModelSection_TransitionLinkOffsets, &LinkCount, sizeof(int));
+        LinkCount += Transition ? sb_count(Transition->PreviousIds) : 0;
+        printf("%d,\n", LinkCount);
+        addModelSectionElement(&ModelFile, ModelSection_TransitionLinkOffsets, &LinkCount, sizeof(int));
+        LinkCount += Transition ? sb_count(Transition->NextIds) : 0;
+    }
+    printf("    %d\n};\n", LinkCount);
+    addModelSectionElement(&ModelFile, ModelSection_TransitionLinkOffsets, &LinkCount, sizeof(int));
+
+    printf("\nstatic const state_id TransitionLinks[%d] = {\n", LinkCount ? LinkCount : 1);
+    for(int Id = 0; Id < TransitionSlotCount; ++Id) {
+        if(TransitionSlots[Id] >= 0) {
+            transition_info *Transition = Transitions + TransitionSlots[Id];
+            int *Lists[] = {Transition->PreviousIds, Transition->NextIds};
+            printf("   ");
+            for(int ListIndex = 0; ListIndex < ArrayCount(Lists); ++ListIndex) {
+                for(int Index = 0; Index < sb_count(Lists[ListIndex]); ++Index) {
+                    printf(" %d,", Lists[ListIndex][Index]);
+                    addModelSectionElement(&ModelFile, ModelSection_TransitionLinks, Lists[ListIndex] + Index,
+                                           sizeof(int));
+                }
+            }
+            printf("\n");
+        }
+    }
+    printf("};\n");
+
+    uint64_t *MaskWords = 0;
+    model_state_mask *Masks = calloc(TransitionSlotCount + 1, sizeof(model_state_mask));
+    for(int ListIndex = 0; ListIndex < 2; ++ListIndex) {
+        printf("\nstatic const state_mask %s[TransitionCount] = {\n",
+               ListIndex == 0 ? "TransitionPreviousMasks" : "TransitionNextMasks");
+        memset(Masks, 0, (TransitionSlotCount + 1)*sizeof(model_state_mask));
+        for(int Id = 0; Id < TransitionSlotCount; ++Id) {
+            if(TransitionSlots[Id] < 0) {
+                continue;
+            }
+            transition_info *Transition = Transitions + TransitionSlots[Id];
+            int Offset = sb_count(MaskWords);
+            int FirstWord = appendMask(ListIndex == 0 ? Transition->PreviousIds : Transition->NextIds, &MaskWords);
+            printf("    [Transition_%s] = {%d, %d, %d},\n", Transition->Name, FirstWord,
+                   sb_count(MaskWords) - Offset, Offset);
+            Masks[Id] = (model_state_mask){(uint32_t)FirstWord, (uint32_t)(sb_count(MaskWords) - Offset), (uint32_t)Offset};
+        }
+        printf("};\n");
+        addModelSection(&ModelFile, ListIndex == 0 ? ModelSection_TransitionPreviousMasks : ModelSection_TransitionNextMasks,
+                        Masks, TransitionSlotCount*sizeof(model_state_mask));
+    }
+    free(Masks);
+
+    printf("\nstatic const uint64_t StateMaskWords[%d] = {\n", sb_count(MaskWords) ? sb_count(MaskWords) : 1);
+    for(int I = 0; I < sb_count(MaskWords); ++I) {
+        printf("    0x%016llxull,\n", (unsigned long long)MaskWords[I]);
+    }
+    printf("};\n");
+    addModelSection(&ModelFile, ModelSection_StateMaskWords, MaskWords, sb_count(MaskWords)*sizeof(uint64_t));
+
+    // NOTE(nox): Dependencies of the conditions, used to re-evaluate only the transitions whose
+    // inputs, upstream states or timers may have changed
+    name_table InputIds = {};
+    char **InputLabels = 0;
+    int **InputReaders = 0;
+    int **StateWatchers = calloc(sb_count(States) + 1, sizeof(int *));
+    int **StateTimerReaders = calloc(sb_count(States) + 1, sizeof(int *));
+    uint64_t *TimedStates = calloc(StateSlotCount/64 + 1, sizeof(uint64_t));
+    uint64_t *VolatileTransitions = calloc(TransitionSlotCount/64 + 1, sizeof(uint64_t));
+    for(int Id = 0; Id < TransitionSlotCount; ++Id) {
+        int T = TransitionSlots[Id];
+        if(T < 0) {
+            continue;
+        }
+        transition_info *Transition = Transitions + T;
+
+        for(int Index = 0; Index < sb_count(Transition->InputReads); ++Index) {
+            char *Label = Transition->InputReads[Index];
+            int Input = findName(&InputIds, Label);
+            if(Input < 0) {
+                Input = sb_count(InputLabels);
+                insertName(&InputIds, Label, Input);
+                char *Key = calloc(1, strlen(Label) + 4);
+                sprintf(Key, "IO_%s", Label);
+                sb_push(InputLabels, Key);
+                sb_push(InputReaders, 0);
+            }
+            pushDependency(&InputReaders[Input], T);
+        }
+
+        // NOTE(nox): A transition watches the states above it, so it is tested when it may
+        // become enabled, and every state whose activity it reads
+        for(int Index = 0; Index < sb_count(Transition->PreviousStates); ++Index) {
+            int State = findName(&StateIds, Transition->PreviousStates[Index]);
+            if(State >= 0) pushDependency(&StateWatchers[State], T);
+        }
+        char **Reads[] = {Transition->ActiveReads, Transition->TimerReads};
+        for(int ReadIndex = 0; ReadIndex < ArrayCount(Reads); ++ReadIndex) {
+            for(int Index = 0; Index < sb_count(Reads[ReadIndex]); ++Index) {
+                int State = findName(&StateIds, Reads[ReadIndex][Index]);
+                if(State < 0) {
+                    fprintf(stderr, "Error: Transition %s reads undeclared state %s.\n",
+                            Transition->Name, Reads[ReadIndex][Index]);
+                } else if(ReadIndex == 0) {
+                    pushDependency(&StateWatchers[State], T);
+                } else {
+                    pushDependency(&StateTimerReaders[State], T);
+                    TimedStates[States[State].Id/64] |= 1ull << (States[State].Id % 64);
+                }
+            }
+        }
+
+        if(Transition->Volatile) {
+            VolatileTransitions[Id/64] |= 1ull << (Id % 64);
+        }
+    }
+
+    // NOTE(nox): Timer thresholds, grouped by state so activating a state schedules a
+    // contiguous range of them in the timer wheel of its grafcet
+    int **StateThresholds = calloc(sb_count(States) + 1, sizeof(int *));
+    timer_threshold_info *Thresholds = 0;
+    for(int Id = 0; Id < TransitionSlotCount; ++Id) {
+        int T = TransitionSlots[Id];
+        if(T < 0) {
+            continue;
+        }
+        transition_info *Transition = Transitions + T;
+        for(int Index = 0; Index < sb_count(Transition->Thresholds); ++Index) {
+            int State = findName(&StateIds, Transition->ThresholdStates[Index]);
+            if(State < 0) {
+                fprintf(stderr, "Error: Transition %s reads undeclared state %s.\n",
+                        Transition->Name, Transition->ThresholdStates[Index]);
+            } else {
+                timer_threshold_info Threshold = {State, T, Transition->Thresholds[Index]};
+                sb_push(StateThresholds[State], sb_count(Thresholds));
+                sb_push(Thresholds, Threshold);
+            }
+        }
+    }
+
+    printf("\nstatic const timer_threshold TimerThresholds[TimerThresholdCount + 1] = {\n");
+    int ThresholdCount = 0;
+    for(int Id = 0; Id < StateSlotCount; ++Id) {
+        int State = StateSlots[Id];
+        if(State < 0) {
+            continue;
+        }
+        for(int Index = 0; Index < sb_count(StateThresholds[State]); ++Index) {
+            timer_threshold_info *Threshold = Thresholds + StateThresholds[State][Index];
+            printf("    {State_%s, Transition_%s, %d, %d},\n", States[State].Name,
+                   Transitions[Threshold->Transition].Name, States[State].Grafcet, Threshold->Milliseconds);
+            model_timer_threshold Entry = {(uint32_t)States[State].Id, (uint32_t)Transitions[Threshold->Transition].Id,
+                                           (uint32_t)States[State].Grafcet, (uint32_t)Threshold->Milliseconds};
+            addModelSectionElement(&ModelFile, ModelSection_TimerThresholds, &Entry, sizeof(Entry));
+        }
+    }
+    printf("};\n");
+
+    printf("\nstatic const dependency_list StateTimerThresholds[StateCount] = {\n");
+    model_dependency_list *ThresholdLists = calloc(StateSlotCount + 1, sizeof(model_dependency_list));
+    for(int Id = 0; Id < StateSlotCount; ++Id) {
+        int State = StateSlots[Id];
+        if(State >= 0 && sb_count(StateThresholds[State])) {
+            printf("    [State_%s] = {%d, %d},\n", States[State].Name, ThresholdCount,
+                   sb_count(StateThresholds[State]));
+            ThresholdLists[Id] = (model_dependency_list){(uint32_t)ThresholdCount,
+                                                         (uint32_t)sb_count(StateThresholds[State])};
+            ThresholdCount += sb_count(StateThresholds[State]);
+        }
+    }
+    printf("};\n");
+    addModelSection(&ModelFile, ModelSection_StateTimerThresholds, ThresholdLists,
+                    StateSlotCount*sizeof(model_dependency_list));
+    free(ThresholdLists);
+
+    char **StateKeys = malloc((sb_count(States) + 1)*sizeof(char *));
+    int *StateKeyIds = malloc((sb_count(States) + 1)*sizeof(int));
+    for(int I = 0; I < sb_count(States); ++I) {
+        StateKeys[I] = calloc(1, strlen(States[I].Name) + 7);
+        sprintf(StateKeys[I], "State_%s", States[I].Name);
+        StateKeyIds[I] = States[I].Id;
+    }
+    int *InputKeyIds = malloc((sb_count(InputLabels) + 1)*sizeof(int));
+    for(int Key = 0; Key < sb_count(InputLabels); ++Key) {
+        InputKeyIds[Key] = -1;
+        for(int Input = 0; Input < sb_count(InputNames); ++Input) {
+            if(strcmp(InputNames[Input], InputLabels[Key] + 3) == 0) {
+                InputKeyIds[Key] = Input;
+            }
+        }
+    }
+
+    emitDependencyTable("InputReaders", "ArrayCount(Inputs)", InputLabels, InputReaders, sb_count(InputLabels),
+                        InputKeyIds, sb_count(InputNames), ModelSection_InputReaders);
+    emitDependencyTable("StateWatchers", "StateCount", StateKeys, StateWatchers, sb_count(States), StateKeyIds,
+                        StateSlotCount, ModelSection_StateWatchers);
+    emitDependencyTable("StateTimerReaders", "StateCount", StateKeys, StateTimerReaders, sb_count(States),
+                        StateKeyIds, StateSlotCount, ModelSection_StateTimerReaders);
+
+    printf("\nstatic const uint64_t TimedStates[StateWordCount] = {\n");
+    for(int Word = 0; Word < StateSlotCount/64; ++Word) {
+        printf("    0x%016llxull,\n", (unsigned long long)TimedStates[Word]);
+    }
+    printf("};\n");
+    addModelSection(&ModelFile, ModelSection_TimedStates, TimedStates, StateSlotCount/64*sizeof(uint64_t));
+
+    printf("\nstatic const uint64_t VolatileTransitions[TransitionWordCount] = {\n");
+    for(int Word = 0; Word < TransitionSlotCount/64; ++Word) {
+        printf("    0x%016llxull,\n", (unsigned long long)VolatileTransitions[Word]);
+    }
+    printf("};\n");
+    addModelSection(&ModelFile, ModelSection_VolatileTransitions, VolatileTransitions,
+                    TransitionSlotCount/64*sizeof(uint64_t));
+
+    emitCode();
+}
+
+// NOTE(nox): Scan function of every grafcet: the phases of scanGrafcet with the conditions, the
+// enabling masks and the step changes of each transition, and the action of each step, inlined as
+// constants in switches over the ids, so there is no dispatch through the tables. Like the generic
+// scan, only the dirty transitions are evaluated and steps change through leaveStep and
+// enterStep, so timers, dirty marks and the flight recorder follow both the same way.
+static void emitEnablingTest(int *Ids) {
+    uint64_t *Mask = 0;
+    int FirstWord = appendMask(Ids, &Mask);
+    for(int Word = 0; Word < sb_count(Mask); ++Word) {
+        printf("%s(ActiveStates[%d] & 0x%llxull) == 0x%llxull", Word ? " && " : "", FirstWord + Word,
+               (unsigned long long)Mask[Word], (unsigned long long)Mask[Word]);
+    }
+    if(!sb_count(Mask)) {
+        printf("true");
+    }
+    sb_free(Mask);
+}
+
+static void emitStepChanges(transition_info *Transition, bool Enter) {
+    int *Ids = Enter ? Transition->NextIds : Transition->PreviousIds;
+    uint64_t *Mask = 0;
+    int FirstWord = appendMask(Ids, &Mask);
+    printf("            case Transition_%s:", Transition->Name);
+    for(int Word = 0; Word < sb_count(Mask); ++Word) {
+        printf(Enter ? " ActiveStates[%d] |= 0x%llxull;" : " ActiveStates[%d] &= ~0x%llxull;", FirstWord + Word,
+               (unsigned long long)Mask[Word]);
+    }
+    for(int Index = 0; Index < sb_count(Ids); ++Index) {
+        printf(" %s(State_%s);", Enter ? "enterStep" : "leaveStep", States[StateSlots[Ids[Index]]].Name);
+    }
+    printf(" break;\n");
+    sb_free(Mask);
+}
+
+static void emitScanFunctions() {
+    printf("#define GENERATED_SCAN_FUNCTIONS\n");
+    for(int Grafcet = 0; Grafcet < GrafcetCount; ++Grafcet) {
+        int FirstTransition = GrafcetTransitionStarts[Grafcet], EndTransition = GrafcetTransitionStarts[Grafcet + 1];
+        int FirstWord = FirstTransition/64, EndWord = EndTransition/64;
+        printf("\nstatic SCAN_FUNCTION(scanGrafcet_%d) {\n", Grafcet);
+        printf("    profileStart(Start);\n");
+        printf("    if(GrafcetFrozen[%d]) {\n", Grafcet);
+        printf("        memset(FiredTransitions + %d, 0, %d*sizeof(*FiredTransitions));\n", FirstWord,
+               EndWord - FirstWord);
+        printf("    } else {\n");
+        printf("        for(int Word = %d; Word < %d; ++Word) {\n", FirstWord, EndWord);
+        printf("            uint64_t Fired = 0;\n");
+        printf("            for(uint64_t Bits = DirtyTransitions[Word]; Bits; Bits &= Bits - 1) {\n");
+        printf("                transition_id Id = 64*Word + __builtin_ctzll(Bits);\n");
+        printf("                bool Fire = false;\n");
+        printf("                switch(Id) {\n");
+        for(int Id = FirstTransition; Id < EndTransition; ++Id) {
+            if(TransitionSlots[Id] < 0) {
+                continue;
+            }
+            transition_info *Transition = Transitions + TransitionSlots[Id];
+            printf("                case Transition_%s:\n", Transition->Name);
+            printf("                    if(");
+            emitEnablingTest(Transition->PreviousIds);
+            printf(") {\n");
+            printf("                        profileStart(ConditionStart);\n");
+            printf("                        Fire = (%s);\n", Transition->Condition);
+            printf("                        profileCount(ConditionCounters[Id], ConditionStart);\n");
+            printf("                    }\n");
+            printf("                    break;\n");
+        }
+        printf("                default:\n");
+        printf("                    break;\n");
+        printf("                }\n");
+        printf("                Fired |= (uint64_t)Fire << (Id %% 64);\n");
+        printf("            }\n");
+        printf("            DirtyTransitions[Word] = 0;\n");
+        printf("            FiredTransitions[Word] = Fired;\n");
+        printf("        }\n");
+        printf("    }\n");
+        printf("    profilePhase(Phase_Evaluation, Start);\n");
+
+        for(int Enter = 0; Enter < 2; ++Enter) {
+            printf("\n    for(int Word = %d; Word < %d; ++Word) {\n", FirstWord, EndWord);
+            printf("        for(uint64_t Bits = FiredTransitions[Word]; Bits; Bits &= Bits - 1) {\n");
+            printf("            transition_id Id = 64*Word + __builtin_ctzll(Bits);\n");
+            if(!Enter) {
+                printf("            flightEvent(Event_TransitionFired, Id);\n");
+            }
+            printf("            switch(Id) {\n");
+            for(int Id = FirstTransition; Id < EndTransition; ++Id) {
+                if(TransitionSlots[Id] >= 0) {
+                    emitStepChanges(Transitions + TransitionSlots[Id], Enter);
+                }
+            }
+            printf("            default: break;\n");
+            printf("            }\n");
+            printf("        }\n");
+            printf("    }\n");
+            printf("    profilePhase(%s, Start);\n", Enter ? "Phase_Activation" : "Phase_Deactivation");
+        }
+
+        printf("\n    for(int Word = %d; Word < %d; ++Word) {\n", GrafcetStateStarts[Grafcet]/64,
+               GrafcetStateStarts[Grafcet + 1]/64);
+        printf("        for(uint64_t Bits = ActiveStates[Word]; Bits; Bits &= Bits - 1) {\n");
+        printf("            switch(64*Word + __builtin_ctzll(Bits)) {\n");
+        for(int Id = GrafcetStateStarts[Grafcet]; Id < GrafcetStateStarts[Grafcet + 1]; ++Id) {
+            if(StateSlots[Id] >= 0) {
+                state_info *State = States + StateSlots[Id];
+                printf("            case State_%s: %s break;\n", State->Name, State->Output);
+            }
+        }
+        printf("            default: break;\n");
+        printf("            }\n");
+        printf("        }\n");
+        printf("    }\n");
+        printf("    profilePhase(Phase_Outputs, Start);\n");
+        printf("}\n");
+    }
+
+    printf("\nstatic scan_function *const GeneratedScans[GrafcetCount] = {\n");
+    for(int Grafcet = 0; Grafcet < GrafcetCount; ++Grafcet) {
+        printf("    scanGrafcet_%d,\n", Grafcet);
+    }
+    printf("};\n");
+}
+
+static void emitBitsetInitializer(char *Name, uint64_t *Words, int WordCount) {
+    printf("\n#define %s {", Name);
+    for(int Word = 0; Word < WordCount; ++Word) {
+        printf("%s \\\n    0x%016llxull", Word ? "," : "", (unsigned long long)Words[Word]);
+    }
+    printf(" }\n");
+}
+
+// NOTE(nox): FNV-1a over the layout of the states and transitions and the links between them, so
+// saved engine state is only loaded into the model it was taken from
+static uint64_t hashBytes(uint64_t Hash, const void *Data, size_t Size) {
+    for(size_t Index = 0; Index < Size; ++Index) {
+        Hash = (Hash ^ ((const uint8_t *)Data)[Index])*1099511628211ull;
+    }
+    return Hash;
+}
+
+static uint64_t topologyHash() {
+    uint64_t Hash = 14695981039346656037ull;
+    for(int I = 0; I < sb_count(States); ++I) {
+        Hash = hashBytes(Hash, States[I].Name, strlen(States[I].Name) + 1);
+        Hash = hashBytes(Hash, &States[I].Id, sizeof(States[I].Id));
+        Hash = hashBytes(Hash, &States[I].Grafcet, sizeof(States[I].Grafcet));
+    }
+    for(int I = 0; I < sb_count(Transitions); ++I) {
+        transition_info *Transition = Transitions + I;
+        Hash = hashBytes(Hash, Transition->Name, strlen(Transition->Name) + 1);
+        Hash = hashBytes(Hash, &Transition->Id, sizeof(Transition->Id));
+        Hash = hashBytes(Hash, Transition->PreviousIds, sb_count(Transition->PreviousIds)*sizeof(int));
+        Hash = hashBytes(Hash, "", 1);
+        Hash = hashBytes(Hash, Transition->NextIds, sb_count(Transition->NextIds)*sizeof(int));
+    }
+    return Hash;
+}
+
+// NOTE(nox): FNV-1a over the text of the actions and conditions, which the engine has compiled in
+static uint64_t behaviourHash() {
+    uint64_t Hash = 14695981039346656037ull;
+    for(int I = 0; I < sb_count(States); ++I) {
+        Hash = hashBytes(Hash, States[I].Name, strlen(States[I].Name) + 1);
+        Hash = hashBytes(Hash, States[I].Output, strlen(States[I].Output) + 1);
+    }
+    for(int I = 0; I < sb_count(Transitions); ++I) {
+        Hash = hashBytes(Hash, Transitions[I].Name, strlen(Transitions[I].Name) + 1);
+        Hash = hashBytes(Hash, Transitions[I].Condition, strlen(Transitions[I].Condition) + 1);
+    }
+    return Hash;
+}
+
+static void emitIds() {
+    printf("typedef enum {\n");
+    for(int Id = 0; Id < StateSlotCount; ++Id) {
+        if(StateSlots[Id] >= 0) {
+            printf("    State_%s = %d,\n", States[StateSlots[Id]].Name, Id);
+        }
+    }
+    printf("    StateCount = %d\n} state_id;\n", StateSlotCount);
+
+    printf("\ntypedef enum {\n");
+    for(int Id = 0; Id < TransitionSlotCount; ++Id) {
+        if(TransitionSlots[Id] >= 0) {
+            printf("    Transition_%s = %d,\n", Transitions[TransitionSlots[Id]].Name, Id);
+        }
+    }
+    printf("    TransitionCount = %d\n} transition_id;\n", TransitionSlotCount);
+
+    int ThresholdCount = 0;
+    for(int I = 0; I < sb_count(Transitions); ++I) {
+        ThresholdCount += sb_count(Transitions[I].Thresholds);
+    }
+
+    printf("\nenum {\n    GrafcetCount = %d,\n    GrafcetLevelCount = %d,\n    StateWordCount = %d,\n"
+           "    TransitionWordCount = %d,\n    TimerThresholdCount = %d\n};\n",
+           GrafcetCount, GrafcetLevelCount, StateSlotCount/64, TransitionSlotCount/64, ThresholdCount);
+
+    printf("\n#define TOPOLOGY_HASH 0x%016llxull\n", (unsigned long long)topologyHash());
+    printf("#define BEHAVIOUR_HASH 0x%016llxull\n", (unsigned long long)behaviourHash());
+
+    // NOTE(nox): Initial situation and declared transitions, as bitset initializers
+    uint64_t *Words = calloc(StateSlotCount/64 + 1, sizeof(uint64_t));
+    for(int I = 0; I < sb_count(States); ++I) {
+        if(States[I].Initial) {
+            Words[States[I].Id/64] |= 1ull << (States[I].Id % 64);
+        }
+    }
+    emitBitsetInitializer("INITIAL_ACTIVE_STATES", Words, StateSlotCount/64);
+    free(Words);
+
+    Words = calloc(TransitionSlotCount/64 + 1, sizeof(uint64_t));
+    for(int I = 0; I < sb_count(Transitions); ++I) {
+        Words[Transitions[I].Id/64] |= 1ull << (Transitions[I].Id % 64);
+    }
+    emitBitsetInitializer("DECLARED_TRANSITIONS", Words, TransitionSlotCount/64);
+    free(Words);
+}
+
+static char *ModelStrings = 0;
+
+static uint32_t addModelString(char *String) {
+    if(!sb_count(ModelStrings)) {
+        sb_push(ModelStrings, 0);
+    }
+    uint32_t Offset = sb_count(ModelStrings);
+    memcpy(sb_add(ModelStrings, strlen(String) + 1), String, strlen(String) + 1);
+    return Offset;
+}
+
+// NOTE(nox): Completes the binary model with what emitTopology leaves out: the counts, the
+// initial situation, the names and the I/O tables. Inputs and outputs come from the model's
+// inputMacro and outputMacro.
+static bool writeModel(char *Path) {
+    model_file_header *Header = &ModelFile.Header;
+    Header->TopologyHash = topologyHash();
+    Header->BehaviourHash = behaviourHash();
+    Header->GrafcetCount = GrafcetCount;
+    Header->GrafcetLevelCount = GrafcetLevelCount;
+    Header->StateCount = StateSlotCount;
+    Header->TransitionCount = TransitionSlotCount;
+    Header->InputCount = sb_count(InputNames);
+    Header->OutputCount = sb_count(OutputNames);
+    for(int I = 0; I < sb_count(Transitions); ++I) {
+        Header->TimerThresholdCount += sb_count(Transitions[I].Thresholds);
+    }
+
+    uint64_t *Words = calloc(StateSlotCount/64 + TransitionSlotCount/64 + 1, sizeof(uint64_t));
+    for(int I = 0; I < sb_count(States); ++I) {
+        if(States[I].Initial) {
+            Words[States[I].Id/64] |= 1ull << (States[I].Id % 64);
+        }
+    }
+    addModelSection(&ModelFile, ModelSection_InitialStates, Words, StateSlotCount/64*sizeof(uint64_t));
+    memset(Words, 0, StateSlotCount/64*sizeof(uint64_t));
+    for(int I = 0; I < sb_count(Transitions); ++I) {
+        Words[Transitions[I].Id/64] |= 1ull << (Transitions[I].Id % 64);
+    }
+    addModelSection(&ModelFile, ModelSection_DeclaredTransitions, Words, TransitionSlotCount/64*sizeof(uint64_t));
+    free(Words);
+
+    uint32_t *Names = calloc(StateSlotCount + TransitionSlotCount + 1, sizeof(uint32_t));
+    for(int I = 0; I < sb_count(States); ++I) {
+        Names[States[I].Id] = addModelString(States[I].Name + 1);
+    }
+    addModelSection(&ModelFile, ModelSection_StateNames, Names, StateSlotCount*sizeof(uint32_t));
+    memset(Names, 0, StateSlotCount*sizeof(uint32_t));
+    for(int I = 0; I < sb_count(Transitions); ++I) {
+        Names[Transitions[I].Id] = addModelString(Transitions[I].Name);
+    }
+    addModelSection(&ModelFile, ModelSection_TransitionNames, Names, TransitionSlotCount*sizeof(uint32_t));
+    free(Names);
+
+    for(int Input = 0; Input < sb_count(InputNames); ++Input) {
+        uint32_t Name = addModelString(InputNames[Input]);
+        addModelSectionElement(&ModelFile, ModelSection_InputNames, &Name, sizeof(Name));
+    }
+    addModelSection(&ModelFile, ModelSection_InputKeys, InputKeys, sb_count(InputKeys));
+    for(int Output = 0; Output < sb_count(OutputNames); ++Output) {
+        uint32_t Name = addModelString(OutputNames[Output]);
+        addModelSectionElement(&ModelFile, ModelSection_OutputNames, &Name, sizeof(Name));
+    }
+    if(!sb_count(ModelStrings)) {
+        sb_push(ModelStrings, 0);
+    }
+    addModelSection(&ModelFile, ModelSection_Strings, ModelStrings, sb_count(ModelStrings));
+    return writeModelFile(&ModelFile, Path);
+}
+
 int main(int ArgCount, char **Args) {
-    if(ArgCount < 2) {
+    bool ScanFunctions = false;
+    char *ModelPath = 0;
+    char *FileName = 0;
+    for(int ArgIndex = 1; ArgIndex < ArgCount; ++ArgIndex) {
+        if(strcmp(Args[ArgIndex], "--scan-functions") == 0) {
+            ScanFunctions = true;
+        } else if(strcmp(Args[ArgIndex], "--model-file") == 0 && ArgIndex + 1 < ArgCount) {
+            ModelPath = Args[++ArgIndex];
+        } else {
+            FileName = Args[ArgIndex];
+        }
+    }
+    if(!FileName) {
+        fprintf(stderr, "Usage: %s [--scan-functions] [--model-file path] file\n", Args[0]);
         return -1;
     }
 
-    char *FileContents = readEntireFileIntoMemoryAndNullTerminate(Args[1]);
+    char *FileContents = readEntireFileIntoMemoryAndNullTerminate(FileName);
     tokenizer Tokenizer = {};
     Tokenizer.At = FileContents;
 
@@ -405,11 +2023,21 @@ int main(int ArgCount, char **Args) {
 
             case Token_Identifier:
             {
-                if(!tokenEquals(PreviousToken, "define")) {
+                if(tokenEquals(PreviousToken, "define")) {
+                    if(tokenEquals(Token, "inputMacro")) {
+                        parseIoMacro(&Tokenizer, &InputNames, &InputKeys);
+                    } else if(tokenEquals(Token, "outputMacro")) {
+                        parseIoMacro(&Tokenizer, &OutputNames, 0);
+                    }
+                } else {
                     if(tokenEquals(Token, "newState")) {
                         parseFunction(&Tokenizer, Function_NewState);
+                    } else if(tokenEquals(Token, "newInitialState")) {
+                        parseFunction(&Tokenizer, Function_NewInitialState);
                     } else if(tokenEquals(Token, "newTransition")) {
                         parseFunction(&Tokenizer, Function_NewTransition);
+                    } else if(tokenEquals(Token, "grafcetPeriod")) {
+                        parseFunction(&Tokenizer, Function_GrafcetPeriod);
                     }
                 }
             } break;
@@ -420,19 +2048,36 @@ int main(int ArgCount, char **Args) {
         }
         PreviousToken = Token;
     }
+    layoutModel();
+    computeGrafcetLevels();
+
+    printf("\n#elif defined(TOPOLOGY)\n\n");
+    emitTopology();
+
+    printf("\n#elif defined(SCAN_FUNCTIONS)\n\n");
+    if(ScanFunctions) {
+        emitScanFunctions();
+    }
+
     printf("\n#else\n\n");
+    emitIds();
 
-    printf("typedef enum {\n");
+    // NOTE(nox): Lists of the states and transitions, so other engines can build their own tables
+    // after including the functions again with different macros, and tools can name the ids
+    printf("\n#define MODEL_STATES(W)");
     for(int I = 0; I < sb_count(States); ++I) {
-        printf("    State_%s,\n", States[I]);
+        printf(" W(%s)", States[I].Name);
     }
-    printf("    StateCount\n} state_id;\n");
-
-    printf("\ntypedef enum {\n");
+    printf("\n#define MODEL_TRANSITIONS(W)");
     for(int I = 0; I < sb_count(Transitions); ++I) {
-        printf("    Transition_%s,\n", Transitions[I]);
+        printf(" W(%s)", Transitions[I].Name);
     }
-    printf("    TransitionCount\n} transition_id;\n");
+    printf("\n");
 
     printf("\n#endif\n");
+
+    if(ModelPath && !writeModel(ModelPath)) {
+        fprintf(stderr, "Error: Could not write the binary model %s.\n", ModelPath);
+        return -1;
+    }
 }
@@ -0,0 +1,123 @@
+// -------------------------
+// Generic Grafcet Framework - Process image client
+// -------------------------
+
+// MIT License:
+//
+// Copyright 2018 Gonçalo Santos
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "process_image.h"
+
+// NOTE(nox): Reference client of the shared process image of main.out --shm: lists the inputs
+// and outputs, sets inputs and follows the output changes. It only knows the names stored in
+// the segment, so it works with any model.
+#define MAX_IMAGE_WORDS 64
+
+static bool imageBit(const uint64_t *Words, uint32_t Index) {
+    return (Words[Index/64] >> (Index%64)) & 1;
+}
+
+static int findInput(process_image *Image, const char *Name) {
+    for(uint32_t Index = 0; Index < Image->InputCount; ++Index) {
+        if(strcmp(processImageName(Image, InputNamesOffset, Index), Name) == 0) {
+            return (int)Index;
+        }
+    }
+    return -1;
+}
+
+static void listImage(process_image *Image) {
+    uint64_t Outputs[MAX_IMAGE_WORDS];
+    uint64_t Cycle = readProcessOutputs(Image, Outputs, 0);
+    const uint64_t *Inputs = processImageWords(Image, InputImageOffset);
+    printf("Cycle %llu\nInputs:\n", (unsigned long long)Cycle);
+    for(uint32_t Index = 0; Index < Image->InputCount; ++Index) {
+        printf("%12s: %d\n", processImageName(Image, InputNamesOffset, Index), imageBit(Inputs, Index));
+    }
+    printf("Outputs:\n");
+    for(uint32_t Index = 0; Index < Image->OutputCount; ++Index) {
+        printf("%12s: %d\n", processImageName(Image, OutputNamesOffset, Index), imageBit(Outputs, Index));
+    }
+}
+
+// NOTE(nox): Polls the outputs every millisecond and prints the ones that changed
+static void watchImage(process_image *Image, double Seconds) {
+    uint64_t Previous[MAX_IMAGE_WORDS] = {0}, Outputs[MAX_IMAGE_WORDS];
+    uint64_t LastCycle = 0;
+    struct timespec Period = {0, 1000000};
+    for(double Elapsed = 0; Seconds <= 0 || Elapsed < Seconds; Elapsed += 1e-3) {
+        uint64_t Cycle = readProcessOutputs(Image, Outputs, 0);
+        if(Cycle != LastCycle) {
+            for(uint32_t Index = 0; Index < Image->OutputCount; ++Index) {
+                if(imageBit(Outputs, Index) != imageBit(Previous, Index)) {
+                    printf("%llu %s %s\n", (unsigned long long)Cycle, processImageName(Image, OutputNamesOffset, Index),
+                           imageBit(Outputs, Index) ? "on" : "off");
+                }
+            }
+            fflush(stdout);
+            memcpy(Previous, Outputs, sizeof(Previous));
+            LastCycle = Cycle;
+        }
+        nanosleep(&Period, 0);
+    }
+}
+
+int main(int Argc, char *Argv[]) {
+    if(Argc < 3) {
+        fprintf(stderr, "Usage: %s name list\n"
+                "       %s name set input 0|1\n"
+                "       %s name watch [seconds]\n", Argv[0], Argv[0], Argv[0]);
+        return -1;
+    }
+    process_image *Image = openProcessImage(Argv[1]);
+    if(!Image) {
+        fprintf(stderr, "No process image %s (is main.out running with --shm?)\n", Argv[1]);
+        return -1;
+    }
+    if(processImageWordCount(Image->OutputCount) > MAX_IMAGE_WORDS) {
+        fprintf(stderr, "Too many outputs\n");
+        return -1;
+    }
+
+    int Result = 0;
+    if(strcmp(Argv[2], "list") == 0) {
+        listImage(Image);
+    } else if(strcmp(Argv[2], "set") == 0 && Argc == 5) {
+        int Input = findInput(Image, Argv[3]);
+        if(Input < 0 || !writeProcessInput(Image, (uint32_t)Input, atoi(Argv[4]) != 0)) {
+            fprintf(stderr, "No input %s\n", Argv[3]);
+            Result = -1;
+        }
+    } else if(strcmp(Argv[2], "watch") == 0) {
+        watchImage(Image, Argc > 3 ? atof(Argv[3]) : 0);
+    } else {
+        fprintf(stderr, "Unknown command %s\n", Argv[2]);
+        Result = -1;
+    }
+    closeProcessImage(Image);
+    return Result;
+}
@@ -0,0 +1,212 @@
+// -------------------------
+// Generic Grafcet Framework - Shared process image
+// -------------------------
+
+// MIT License:
+//
+// Copyright 2018 Gonçalo Santos
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+
+#if !defined(PROCESS_IMAGE_H)
+#define PROCESS_IMAGE_H
+
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// NOTE(nox): Input and output process images in a POSIX shared memory segment, so a plant
+// simulator or an HMI exchanges I/O with the engine through plain memory accesses. Each image
+// has one writer and is guarded by a sequence number, odd while it is being written:
+// - inputs are written by one client at a time and read by the engine at the start of every
+//   cycle; an image caught in the middle of a write is simply read again on the next cycle, so
+//   the engine never waits;
+// - outputs, with the cycle, its release time and the active steps, are written by the engine at
+//   the end of every cycle; readers retry until they copy an image that was not rewritten.
+// The names of the inputs and outputs follow, so clients need not be built against the model.
+#define PROCESS_IMAGE_MAGIC 0x49504747 // NOTE(nox): "GGPI"
+#define PROCESS_IMAGE_VERSION 1
+#define PROCESS_IMAGE_NAME_LENGTH 25
+
+typedef struct {
+    _Atomic uint32_t Magic;
+    uint32_t Version;
+    uint32_t Size;
+    uint32_t InputCount;
+    uint32_t OutputCount;
+    uint32_t StateWordCount;
+    uint32_t InputImageOffset;
+    uint32_t OutputImageOffset;
+    uint32_t StateImageOffset;
+    uint32_t InputNamesOffset;
+    uint32_t OutputNamesOffset;
+
+    _Alignas(64) _Atomic uint32_t InputSequence;
+
+    _Alignas(64) _Atomic uint32_t OutputSequence;
+    uint64_t Cycle;
+    uint64_t ScanTime;
+} process_image;
+
+#define processImageWords(Image, Offset) ((uint64_t *)((char *)(Image) + (Image)->Offset))
+#define processImageName(Image, Offset, Index) ((char *)(Image) + (Image)->Offset + (Index)*PROCESS_IMAGE_NAME_LENGTH)
+#define processImageWordCount(Count) (((Count) + 63)/64)
+
+// NOTE(nox): Engine side: creates the segment, replacing any stale one with the same name
+static process_image *createProcessImage(const char *Name, uint32_t InputCount, uint32_t OutputCount,
+                                         uint32_t StateWordCount) {
+    uint32_t InputImageOffset = (sizeof(process_image) + 63) & ~63u;
+    uint32_t OutputImageOffset = InputImageOffset + 8*processImageWordCount(InputCount);
+    uint32_t StateImageOffset = OutputImageOffset + 8*processImageWordCount(OutputCount);
+    uint32_t InputNamesOffset = StateImageOffset + 8*StateWordCount;
+    uint32_t OutputNamesOffset = InputNamesOffset + PROCESS_IMAGE_NAME_LENGTH*InputCount;
+    uint32_t Size = OutputNamesOffset + PROCESS_IMAGE_NAME_LENGTH*OutputCount;
+
+    shm_unlink(Name);
+    int Fd = shm_open(Name, O_CREAT | O_EXCL | O_RDWR, 0660);
+    if(Fd < 0) {
+        return 0;
+    }
+    process_image *Image = 0;
+    if(ftruncate(Fd, Size) == 0) {
+        Image = (process_image *)mmap(0, Size, PROT_READ | PROT_WRITE, MAP_SHARED, Fd, 0);
+    }
+    close(Fd);
+    if(!Image || Image == MAP_FAILED) {
+        shm_unlink(Name);
+        return 0;
+    }
+
+    Image->Version = PROCESS_IMAGE_VERSION;
+    Image->Size = Size;
+    Image->InputCount = InputCount;
+    Image->OutputCount = OutputCount;
+    Image->StateWordCount = StateWordCount;
+    Image->InputImageOffset = InputImageOffset;
+    Image->OutputImageOffset = OutputImageOffset;
+    Image->StateImageOffset = StateImageOffset;
+    Image->InputNamesOffset = InputNamesOffset;
+    Image->OutputNamesOffset = OutputNamesOffset;
+    return Image;
+}
+
+// NOTE(nox): Makes the segment visible to clients once the names are filled in
+static void publishProcessImage(process_image *Image) {
+    atomic_store_explicit(&Image->Magic, PROCESS_IMAGE_MAGIC, memory_order_release);
+}
+
+// NOTE(nox): Client side
+static process_image *openProcessImage(const char *Name) {
+    int Fd = shm_open(Name, O_RDWR, 0);
+    if(Fd < 0) {
+        return 0;
+    }
+    process_image *Image = 0;
+    struct stat Stat;
+    if(fstat(Fd, &Stat) == 0 && Stat.st_size >= (off_t)sizeof(process_image)) {
+        Image = (process_image *)mmap(0, Stat.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, Fd, 0);
+    }
+    close(Fd);
+    if(!Image || Image == MAP_FAILED) {
+        return 0;
+    }
+    if(atomic_load_explicit(&Image->Magic, memory_order_acquire) != PROCESS_IMAGE_MAGIC ||
+       Image->Version != PROCESS_IMAGE_VERSION || Image->Size > (uint64_t)Stat.st_size) {
+        munmap(Image, Stat.st_size);
+        return 0;
+    }
+    return Image;
+}
+
+static void closeProcessImage(process_image *Image) {
+    munmap(Image, Image->Size);
+}
+
+// NOTE(nox): Engine side; false while a client is in the middle of a write. The size comes from
+// the engine, not from the segment any client can write, and the bits past the last input are
+// cleared, so a stray bit never reaches the engine as an input.
+static bool readProcessInputs(process_image *Image, uint64_t *Inputs, uint32_t InputCount) {
+    uint32_t Sequence = atomic_load_explicit(&Image->InputSequence, memory_order_acquire);
+    if(Sequence & 1) {
+        return false;
+    }
+    memcpy(Inputs, processImageWords(Image, InputImageOffset), 8*processImageWordCount(InputCount));
+    atomic_thread_fence(memory_order_acquire);
+    if(InputCount % 64) {
+        Inputs[InputCount/64] &= (1ull << (InputCount % 64)) - 1;
+    }
+    return atomic_load_explicit(&Image->InputSequence, memory_order_relaxed) == Sequence;
+}
+
+static void writeProcessOutputs(process_image *Image, uint64_t Cycle, uint64_t ScanTime, const uint64_t *Outputs,
+                                const uint64_t *States) {
+    uint32_t Sequence = atomic_load_explicit(&Image->OutputSequence, memory_order_relaxed);
+    atomic_store_explicit(&Image->OutputSequence, Sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    Image->Cycle = Cycle;
+    Image->ScanTime = ScanTime;
+    memcpy(processImageWords(Image, OutputImageOffset), Outputs, 8*processImageWordCount(Image->OutputCount));
+    memcpy(processImageWords(Image, StateImageOffset), States, 8*Image->StateWordCount);
+    atomic_store_explicit(&Image->OutputSequence, Sequence + 2, memory_order_release);
+}
+
+// NOTE(nox): Client side; only one process may write the inputs at a time. False for an input
+// the engine does not have.
+static bool writeProcessInput(process_image *Image, uint32_t Input, bool Value) {
+    if(Input >= Image->InputCount) {
+        return false;
+    }
+    uint64_t *Word = processImageWords(Image, InputImageOffset) + Input/64;
+    uint32_t Sequence = atomic_load_explicit(&Image->InputSequence, memory_order_relaxed);
+    atomic_store_explicit(&Image->InputSequence, Sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    if(Value) {
+        *Word |= 1ull << (Input%64);
+    } else {
+        *Word &= ~(1ull << (Input%64));
+    }
+    atomic_store_explicit(&Image->InputSequence, Sequence + 2, memory_order_release);
+    return true;
+}
+
+// NOTE(nox): Client side; States may be 0
+static uint64_t readProcessOutputs(process_image *Image, uint64_t *Outputs, uint64_t *States) {
+    for(;;) {
+        uint32_t Sequence = atomic_load_explicit(&Image->OutputSequence, memory_order_acquire);
+        if(Sequence & 1) {
+            continue;
+        }
+        uint64_t Cycle = Image->Cycle;
+        memcpy(Outputs, processImageWords(Image, OutputImageOffset), 8*processImageWordCount(Image->OutputCount));
+        if(States) {
+            memcpy(States, processImageWords(Image, StateImageOffset), 8*Image->StateWordCount);
+        }
+        atomic_thread_fence(memory_order_acquire);
+        if(atomic_load_explicit(&Image->OutputSequence, memory_order_relaxed) == Sequence) {
+            return Cycle;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,91 @@
+// -------------------------
+// Generic Grafcet Framework - Scan profiler
+// -------------------------
+
+// MIT License:
+//
+// Copyright 2018 Gonçalo Santos
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+#if !defined(PROFILER_H)
+#define PROFILER_H
+
+// NOTE(nox): Instrumentation compiled in with -DPROFILE. Times are read from the TSC where there
+// is one (converted to nanoseconds only when dumped) and from CLOCK_MONOTONIC elsewhere. Without
+// PROFILE every macro expands to nothing, so the instrumented code costs nothing.
+#if defined(PROFILE)
+
+#include <stdint.h>
+
+#include "histogram.h"
+#include "scheduler.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define readTimestamp() __rdtsc()
+#else
+#define readTimestamp() getNanoseconds()
+#endif
+
+typedef struct {
+    uint64_t Calls;
+    uint64_t Ticks;
+} call_counter;
+
+// NOTE(nox): Start measures from here; profileLap adds the time since Start to Total and
+// restarts it, so consecutive phases cost one timestamp each. Totals and call counters can be
+// shared by the scan threads (a condition may be evaluated by any of them), so they are added
+// atomically.
+#define profileStart(Start) uint64_t Start = readTimestamp()
+#define profileLap(Total, Start) do {                                   \
+        uint64_t ProfileNow_ = readTimestamp();                         \
+        __atomic_fetch_add(&(Total), ProfileNow_ - (Start), __ATOMIC_RELAXED); \
+        (Start) = ProfileNow_;                                          \
+    } while(0)
+#define profileRecord(Histogram, Start) histogramRecord((Histogram), readTimestamp() - (Start))
+#define profileCount(Counter, Start) do {                               \
+        uint64_t ProfileNow_ = readTimestamp();                         \
+        __atomic_fetch_add(&(Counter).Calls, 1, __ATOMIC_RELAXED);      \
+        __atomic_fetch_add(&(Counter).Ticks, ProfileNow_ - (Start), __ATOMIC_RELAXED); \
+    } while(0)
+
+// NOTE(nox): Timestamp to nanosecond ratio, measured between the first call and the current one
+// (the first call spins for a millisecond to have something to measure)
+static double ticksPerNanosecond() {
+    static uint64_t FirstTicks, FirstNanoseconds;
+    if(!FirstTicks) {
+        FirstTicks = readTimestamp();
+        FirstNanoseconds = getNanoseconds();
+        while(getNanoseconds() - FirstNanoseconds < 1000000) {
+        }
+    }
+    uint64_t Ticks = readTimestamp(), Nanoseconds = getNanoseconds();
+    return (double)(Ticks - FirstTicks)/(Nanoseconds - FirstNanoseconds);
+}
+
+#else
+
+#define profileStart(Start)
+#define profileLap(Total, Start)
+#define profileRecord(Histogram, Start)
+#define profileCount(Counter, Start)
+
+#endif
+
+#endif
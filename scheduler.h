@@ -0,0 +1,158 @@
+// -------------------------
+// Generic Grafcet Framework - Cycle scheduler
+// -------------------------
+
+// MIT License:
+//
+// Copyright 2018 Gonçalo Santos
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#if !defined(SCHEDULER_H)
+#define SCHEDULER_H
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "histogram.h"
+
+// NOTE(nox): Fixed-period scheduler: cycle N is released at Start + N*Period, an absolute
+// deadline on CLOCK_MONOTONIC, so the time spent processing never adds to the period and no
+// drift accumulates. When a cycle ends after the next deadline has already passed:
+// - Overrun_Skip drops the missed releases and waits for the next one still in the future;
+// - Overrun_CatchUp runs the missed cycles back to back until it is on schedule again;
+// - Overrun_Degrade doubles the period (up to SCHEDULER_MAX_DEGRADE times the configured one)
+//   and restores it once cycles fit again in 3/4 of the configured period.
+typedef enum {
+    Overrun_Skip,
+    Overrun_CatchUp,
+    Overrun_Degrade,
+} overrun_policy;
+
+#define SCHEDULER_MAX_DEGRADE 16
+
+typedef struct {
+    overrun_policy Policy;
+    uint64_t BasePeriod;
+    uint64_t Period;
+
+    uint64_t Cycle;
+    uint64_t Start;
+    uint64_t Deadline;
+    uint64_t CycleStart;
+
+    uint64_t Overruns;
+    uint64_t SkippedCycles;
+    histogram Lateness;
+} scheduler;
+
+static inline uint64_t getNanoseconds() {
+    struct timespec Time;
+    clock_gettime(CLOCK_MONOTONIC, &Time);
+    return (uint64_t)Time.tv_sec*1000000000ull + Time.tv_nsec;
+}
+
+static void initScheduler(scheduler *Scheduler, uint64_t Period, overrun_policy Policy) {
+    memset(Scheduler, 0, sizeof(*Scheduler));
+    Scheduler->Policy = Policy;
+    Scheduler->BasePeriod = Scheduler->Period = Period;
+}
+
+// NOTE(nox): Blocks until the release of the next cycle and records how late it started
+static void waitForNextCycle(scheduler *Scheduler) {
+    uint64_t Now = getNanoseconds();
+    if(Scheduler->Cycle == 0) {
+        Scheduler->Start = Scheduler->Deadline = Now;
+    } else {
+        uint64_t Busy = Now - Scheduler->CycleStart;
+        Scheduler->Deadline += Scheduler->Period;
+        if(Now > Scheduler->Deadline) {
+            ++Scheduler->Overruns;
+            switch(Scheduler->Policy) {
+                case Overrun_Skip:
+                {
+                    uint64_t Missed = (Now - Scheduler->Deadline)/Scheduler->Period + 1;
+                    Scheduler->Deadline += Missed*Scheduler->Period;
+                    Scheduler->SkippedCycles += Missed;
+                } break;
+
+                case Overrun_CatchUp:
+                {
+                } break;
+
+                case Overrun_Degrade:
+                {
+                    if(Scheduler->Period < SCHEDULER_MAX_DEGRADE*Scheduler->BasePeriod) {
+                        Scheduler->Period *= 2;
+                    }
+                    Scheduler->Deadline = Now;
+                } break;
+            }
+        } else if(Scheduler->Policy == Overrun_Degrade && Scheduler->Period > Scheduler->BasePeriod &&
+                  4*Busy < 3*Scheduler->BasePeriod) {
+            Scheduler->Period /= 2;
+        }
+
+        struct timespec Deadline = {(time_t)(Scheduler->Deadline/1000000000ull),
+                                    (long)(Scheduler->Deadline%1000000000ull)};
+        while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &Deadline, 0) == EINTR) {
+        }
+    }
+
+    Scheduler->CycleStart = getNanoseconds();
+    uint64_t Lateness = Scheduler->CycleStart > Scheduler->Deadline ? Scheduler->CycleStart - Scheduler->Deadline : 0;
+    histogramRecord(&Scheduler->Lateness, Lateness);
+    ++Scheduler->Cycle;
+}
+
+// NOTE(nox): Release time of the current cycle, counted from the first one. Using the release
+// rather than the wake-up time keeps step timers free of the scheduling jitter.
+static inline uint64_t cycleTime(scheduler *Scheduler) {
+    return Scheduler->Deadline - Scheduler->Start;
+}
+
+static bool parseOverrunPolicy(char *Text, overrun_policy *Policy) {
+    char *Names[] = {"skip", "catch-up", "degrade"};
+    for(int Index = 0; Index < ArrayCount(Names); ++Index) {
+        if(strcmp(Text, Names[Index]) == 0) {
+            *Policy = (overrun_policy)Index;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void formatSchedulerStats(scheduler *Scheduler, char *Buffer, size_t Size) {
+    histogram *Lateness = &Scheduler->Lateness;
+    snprintf(Buffer, Size,
+             "Cycle %llu, period %.3lfms, %llu overruns, %llu skipped\n"
+             "Lateness (us): min %.1lf, p50 %.1lf, p99 %.1lf, p99.9 %.1lf, max %.1lf\n",
+             (unsigned long long)Scheduler->Cycle, Scheduler->Period/1e6,
+             (unsigned long long)Scheduler->Overruns, (unsigned long long)Scheduler->SkippedCycles,
+             Lateness->Min/1e3, histogramPercentile(Lateness, 50)/1e3, histogramPercentile(Lateness, 99)/1e3,
+             histogramPercentile(Lateness, 99.9)/1e3, Lateness->Max/1e3);
+}
+
+static void printSchedulerStats(scheduler *Scheduler) {
+    char Buffer[256];
+    formatSchedulerStats(Scheduler, Buffer, sizeof(Buffer));
+    fputs(Buffer, stdout);
+}
+
+#endif
@@ -0,0 +1,169 @@
+// -------------------------
+// Generic Grafcet Framework - Timer wheel
+// -------------------------
+
+// MIT License:
+//
+// Copyright 2018 Gonçalo Santos
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#if !defined(TIMER_WHEEL_H)
+#define TIMER_WHEEL_H
+
+// NOTE(nox): Hierarchical timer wheel over a caller-owned array of nodes, referenced by index.
+// A node expiring at tick E lives in the level of the highest 6-bit group in which E differs
+// from the current tick, so level 0 holds the next 64 ticks, level 1 the next 64*64 and so on.
+// When a level wraps the next slot of the level above is cascaded down. Inserting and removing
+// are O(1), and advancing skips empty stretches using the occupancy masks, so the cost follows
+// the number of expiring timers and not the number of timers.
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_NONE UINT32_MAX
+
+typedef struct {
+    uint64_t Expiry;
+    uint32_t Next;
+    uint32_t Previous;
+    uint8_t Level;
+    uint8_t Slot;
+    bool Linked;
+} timer_node;
+
+typedef struct {
+    uint64_t Now;
+    uint64_t Occupied[TIMER_WHEEL_LEVELS];
+    uint32_t Heads[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+} timer_wheel;
+
+#define TIMER_EXPIRED(Name) void Name(uint32_t Node)
+typedef TIMER_EXPIRED(timer_expired);
+
+// NOTE(nox): A slot's head is only meaningful while its Occupied bit is set, so a zeroed wheel
+// is a valid empty wheel at tick 0
+static void initTimerWheel(timer_wheel *Wheel, uint64_t Now) {
+    memset(Wheel, 0, sizeof(*Wheel));
+    Wheel->Now = Now;
+}
+
+static void unlinkTimer(timer_wheel *Wheel, timer_node *Nodes, uint32_t Index) {
+    timer_node *Node = Nodes + Index;
+    if(!Node->Linked) {
+        return;
+    }
+    if(Node->Previous != TIMER_NONE) {
+        Nodes[Node->Previous].Next = Node->Next;
+    } else {
+        Wheel->Heads[Node->Level][Node->Slot] = Node->Next;
+        if(Node->Next == TIMER_NONE) {
+            Wheel->Occupied[Node->Level] &= ~(1ull << Node->Slot);
+        }
+    }
+    if(Node->Next != TIMER_NONE) {
+        Nodes[Node->Next].Previous = Node->Previous;
+    }
+    Node->Linked = false;
+}
+
+static void linkTimer(timer_wheel *Wheel, timer_node *Nodes, uint32_t Index) {
+    timer_node *Node = Nodes + Index;
+    uint64_t Differ = Node->Expiry ^ Wheel->Now;
+    int Level = Differ ? (63 - __builtin_clzll(Differ))/TIMER_WHEEL_SLOT_BITS : 0;
+    if(Level >= TIMER_WHEEL_LEVELS) {
+        // NOTE(nox): Too far away; it is parked on the top level and cascaded again until due
+        Level = TIMER_WHEEL_LEVELS - 1;
+    }
+    Node->Level = (uint8_t)Level;
+    Node->Slot = (uint8_t)((Node->Expiry >> (Level*TIMER_WHEEL_SLOT_BITS)) & (TIMER_WHEEL_SLOTS - 1));
+    Node->Previous = TIMER_NONE;
+    Node->Next = (Wheel->Occupied[Level] & (1ull << Node->Slot)) ? Wheel->Heads[Level][Node->Slot] : TIMER_NONE;
+    if(Node->Next != TIMER_NONE) {
+        Nodes[Node->Next].Previous = Index;
+    }
+    Wheel->Heads[Level][Node->Slot] = Index;
+    Wheel->Occupied[Level] |= 1ull << Node->Slot;
+    Node->Linked = true;
+}
+
+// NOTE(nox): Timers that are already due expire right away
+static void startTimer(timer_wheel *Wheel, timer_node *Nodes, uint32_t Index, uint64_t Expiry,
+                       timer_expired *Expired) {
+    unlinkTimer(Wheel, Nodes, Index);
+    Nodes[Index].Expiry = Expiry;
+    if(Expiry <= Wheel->Now) {
+        Expired(Index);
+    } else {
+        linkTimer(Wheel, Nodes, Index);
+    }
+}
+
+static void takeSlot(timer_wheel *Wheel, timer_node *Nodes, int Level, int Slot, timer_expired *Expired) {
+    uint32_t Index = Wheel->Heads[Level][Slot];
+    Wheel->Heads[Level][Slot] = TIMER_NONE;
+    Wheel->Occupied[Level] &= ~(1ull << Slot);
+    while(Index != TIMER_NONE) {
+        uint32_t Next = Nodes[Index].Next;
+        Nodes[Index].Linked = false;
+        if(Nodes[Index].Expiry <= Wheel->Now) {
+            Expired(Index);
+        } else {
+            linkTimer(Wheel, Nodes, Index);
+        }
+        Index = Next;
+    }
+}
+
+static void advanceTimerWheel(timer_wheel *Wheel, timer_node *Nodes, uint64_t To, timer_expired *Expired) {
+    while(Wheel->Now < To) {
+        uint64_t Pending = 0;
+        for(int Level = 0; Level < TIMER_WHEEL_LEVELS; ++Level) {
+            Pending |= Wheel->Occupied[Level];
+        }
+        if(!Pending) {
+            Wheel->Now = To;
+            break;
+        }
+
+        // NOTE(nox): Jump to the next occupied level 0 slot, or to the next wrap of level 0
+        uint64_t Next = Wheel->Now + 1;
+        uint64_t SlotMask = TIMER_WHEEL_SLOTS - 1;
+        if(Next & SlotMask) {
+            uint64_t Ahead = Wheel->Occupied[0] & (~0ull << (Next & SlotMask));
+            Next = Ahead ? (Next & ~SlotMask) + __builtin_ctzll(Ahead) : (Next | SlotMask) + 1;
+        }
+        if(Next > To) {
+            Wheel->Now = To;
+            break;
+        }
+        Wheel->Now = Next;
+
+        for(int Level = TIMER_WHEEL_LEVELS - 1; Level > 0; --Level) {
+            if((Next & ((1ull << (Level*TIMER_WHEEL_SLOT_BITS)) - 1)) == 0) {
+                int Slot = (int)((Next >> (Level*TIMER_WHEEL_SLOT_BITS)) & SlotMask);
+                if(Wheel->Occupied[Level] & (1ull << Slot)) {
+                    takeSlot(Wheel, Nodes, Level, Slot, Expired);
+                }
+            }
+        }
+        if(Wheel->Occupied[0] & (1ull << (Next & SlotMask))) {
+            takeSlot(Wheel, Nodes, 0, (int)(Next & SlotMask), Expired);
+        }
+    }
+}
+
+#endif
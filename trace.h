@@ -0,0 +1,190 @@
+// -------------------------
+// Generic Grafcet Framework - Input traces
+// -------------------------
+
+// MIT License:
+//
+// Copyright 2018 Gonçalo Santos
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+
+#if !defined(TRACE_H)
+#define TRACE_H
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// NOTE(nox): An input trace is a header followed by 8 byte records in cycle order. An input
+// record holds the value an input took in a cycle; a time record, followed by the 64 bit release
+// time, is only written for cycles not released one period after the previous one (skipped or
+// degraded cycles), so a steady run costs nothing but its input changes. Together they are
+// everything a cycle reads from the outside, which makes a replay deterministic.
+#define TRACE_MAGIC 0x52544747 // NOTE(nox): "GGTR"
+#define TRACE_VERSION 1
+
+typedef enum {
+    TraceRecord_Input,
+    TraceRecord_Time,
+} trace_record_kind;
+
+typedef struct {
+    uint32_t Magic;
+    uint32_t Version;
+    uint32_t InputCount;
+    uint32_t StateCount;
+    uint32_t TransitionCount;
+    uint32_t Reserved;
+    uint64_t Period;
+    // NOTE(nox): Written when the trace is closed; 0 if the recording was interrupted, in which
+    // case the replay stops at the last record
+    uint64_t CycleCount;
+} trace_header;
+
+typedef struct {
+    uint32_t Cycle;
+    uint16_t Input;
+    uint8_t Kind;
+    uint8_t Value;
+} trace_record;
+
+typedef struct {
+    FILE *File;
+    trace_header Header;
+    uint64_t NextTime;
+} trace_writer;
+
+static bool openTraceWriter(trace_writer *Writer, const char *Path, trace_header Header) {
+    memset(Writer, 0, sizeof(*Writer));
+    Writer->File = fopen(Path, "wb");
+    if(!Writer->File) {
+        return false;
+    }
+    setvbuf(Writer->File, 0, _IOFBF, 1 << 16);
+    Header.Magic = TRACE_MAGIC;
+    Header.Version = TRACE_VERSION;
+    Header.CycleCount = 0;
+    Writer->Header = Header;
+    return fwrite(&Header, sizeof(Header), 1, Writer->File) == 1;
+}
+
+// NOTE(nox): Must come before the inputs of the cycle
+static void traceCycleTime(trace_writer *Writer, uint32_t Cycle, uint64_t Time) {
+    if(Writer->File && Time != Writer->NextTime) {
+        trace_record Record = {Cycle, 0, TraceRecord_Time, 0};
+        fwrite(&Record, sizeof(Record), 1, Writer->File);
+        fwrite(&Time, sizeof(Time), 1, Writer->File);
+    }
+    Writer->NextTime = Time + Writer->Header.Period;
+}
+
+static void traceInput(trace_writer *Writer, uint32_t Cycle, int Input, bool Value) {
+    if(Writer->File) {
+        trace_record Record = {Cycle, (uint16_t)Input, TraceRecord_Input, Value};
+        fwrite(&Record, sizeof(Record), 1, Writer->File);
+    }
+}
+
+static void closeTraceWriter(trace_writer *Writer, uint64_t CycleCount) {
+    if(Writer->File) {
+        Writer->Header.CycleCount = CycleCount;
+        fseek(Writer->File, 0, SEEK_SET);
+        fwrite(&Writer->Header, sizeof(Writer->Header), 1, Writer->File);
+        fclose(Writer->File);
+        Writer->File = 0;
+    }
+}
+
+typedef struct {
+    void *Map;
+    size_t Size;
+    const trace_header *Header;
+    const trace_record *Cursor;
+    const trace_record *End;
+    uint64_t NextTime;
+} trace_reader;
+
+// NOTE(nox): The trace is mapped rather than read, so a replay starts at once whatever its length
+// and the records are only paged in as the cycles reach them
+static bool openTraceReader(trace_reader *Reader, const char *Path) {
+    memset(Reader, 0, sizeof(*Reader));
+    int Fd = open(Path, O_RDONLY);
+    if(Fd < 0) {
+        return false;
+    }
+    struct stat Stat;
+    if(fstat(Fd, &Stat) == 0 && Stat.st_size >= (off_t)sizeof(trace_header)) {
+        Reader->Size = (size_t)Stat.st_size;
+        Reader->Map = mmap(0, Reader->Size, PROT_READ, MAP_PRIVATE, Fd, 0);
+    }
+    close(Fd);
+    if(!Reader->Map || Reader->Map == MAP_FAILED) {
+        Reader->Map = 0;
+        return false;
+    }
+    madvise(Reader->Map, Reader->Size, MADV_SEQUENTIAL);
+
+    Reader->Header = (const trace_header *)Reader->Map;
+    Reader->Cursor = (const trace_record *)(Reader->Header + 1);
+    Reader->End = Reader->Cursor + (Reader->Size - sizeof(trace_header))/sizeof(trace_record);
+    return Reader->Header->Magic == TRACE_MAGIC && Reader->Header->Version == TRACE_VERSION;
+}
+
+static void closeTraceReader(trace_reader *Reader) {
+    if(Reader->Map) {
+        munmap(Reader->Map, Reader->Size);
+    }
+    memset(Reader, 0, sizeof(*Reader));
+}
+
+// NOTE(nox): Cycles are numbered from 1
+static bool traceHasCycle(trace_reader *Reader, uint32_t Cycle) {
+    if(Reader->Header->CycleCount) {
+        return Cycle <= Reader->Header->CycleCount;
+    }
+    return Reader->Cursor < Reader->End;
+}
+
+// NOTE(nox): Release time of Cycle; call once per cycle, before its inputs
+static uint64_t readTraceTime(trace_reader *Reader, uint32_t Cycle) {
+    uint64_t Time = Reader->NextTime;
+    if(Reader->Cursor + 1 < Reader->End && Reader->Cursor->Cycle == Cycle &&
+       Reader->Cursor->Kind == TraceRecord_Time) {
+        memcpy(&Time, Reader->Cursor + 1, sizeof(Time));
+        Reader->Cursor += 2;
+    }
+    Reader->NextTime = Time + Reader->Header->Period;
+    return Time;
+}
+
+// NOTE(nox): Next input change of Cycle, or 0 once there are no more
+static const trace_record *readTraceInput(trace_reader *Reader, uint32_t Cycle) {
+    if(Reader->Cursor < Reader->End && Reader->Cursor->Cycle == Cycle &&
+       Reader->Cursor->Kind == TraceRecord_Input) {
+        return Reader->Cursor++;
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,234 @@
+// -------------------------
+// Generic Grafcet Framework - Worker pool
+// -------------------------
+
+// MIT License:
+//
+// Copyright 2018 Gonçalo Santos
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+// to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+// FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+#if !defined(WORKER_POOL_H)
+#define WORKER_POOL_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#define cpuRelax() _mm_pause()
+#else
+#define cpuRelax()
+#endif
+
+// NOTE(nox): Fixed set of threads that all run the same job, once per call to runPoolJob; the
+// calling thread is thread 0 and takes part. Inside a job, poolBarrier is a sense-reversing
+// spin barrier between all of them. Between jobs the workers spin for a while and then sleep on
+// a condition variable, so a pool used every few microseconds stays hot and an idle one costs
+// nothing.
+#define POOL_MAX_THREADS 64
+#define POOL_SPINS_BEFORE_YIELD 4096
+#define POOL_SPINS_BEFORE_SLEEP 8192
+
+#define POOL_JOB(Name) void Name(void *Data, int Thread)
+typedef POOL_JOB(pool_job);
+
+typedef struct worker_pool worker_pool;
+
+typedef struct {
+    worker_pool *Pool;
+    int Thread;
+} pool_worker;
+
+struct worker_pool {
+    int ThreadCount;
+    pool_job *Job;
+    void *Data;
+
+    _Atomic uint64_t Generation;
+    _Atomic int Sleepers;
+    bool Quit;
+    pthread_mutex_t Mutex;
+    pthread_cond_t Wake;
+
+    _Atomic int BarrierCount;
+    _Atomic int BarrierSense;
+    int Senses[POOL_MAX_THREADS];
+
+    pthread_t Threads[POOL_MAX_THREADS];
+    pool_worker Workers[POOL_MAX_THREADS];
+};
+
+static void poolBarrier(worker_pool *Pool, int Thread) {
+    int Sense = Pool->Senses[Thread] = !Pool->Senses[Thread];
+    if(atomic_fetch_add_explicit(&Pool->BarrierCount, 1, memory_order_acq_rel) == Pool->ThreadCount - 1) {
+        atomic_store_explicit(&Pool->BarrierCount, 0, memory_order_relaxed);
+        atomic_store_explicit(&Pool->BarrierSense, Sense, memory_order_release);
+    } else {
+        for(int Spin = 0; atomic_load_explicit(&Pool->BarrierSense, memory_order_acquire) != Sense; ++Spin) {
+            if(Spin < POOL_SPINS_BEFORE_YIELD) {
+                cpuRelax();
+            } else {
+                sched_yield();
+            }
+        }
+    }
+}
+
+static void *runPoolWorker(void *Data) {
+    pool_worker *Worker = (pool_worker *)Data;
+    worker_pool *Pool = Worker->Pool;
+    uint64_t Generation = 0;
+    for(;;) {
+        for(int Spin = 0; Spin < POOL_SPINS_BEFORE_SLEEP && atomic_load(&Pool->Generation) == Generation; ++Spin) {
+            if(Spin < POOL_SPINS_BEFORE_YIELD) {
+                cpuRelax();
+            } else {
+                sched_yield();
+            }
+        }
+        if(atomic_load(&Pool->Generation) == Generation) {
+            pthread_mutex_lock(&Pool->Mutex);
+            atomic_fetch_add(&Pool->Sleepers, 1);
+            while(atomic_load(&Pool->Generation) == Generation && !Pool->Quit) {
+                pthread_cond_wait(&Pool->Wake, &Pool->Mutex);
+            }
+            atomic_fetch_sub(&Pool->Sleepers, 1);
+            pthread_mutex_unlock(&Pool->Mutex);
+        }
+        if(Pool->Quit) {
+            break;
+        }
+
+        Generation = atomic_load(&Pool->Generation);
+        Pool->Job(Pool->Data, Worker->Thread);
+        poolBarrier(Pool, Worker->Thread);
+    }
+    return 0;
+}
+
+// NOTE(nox): Returns the number of threads actually running, which is 1 (no pool) when no
+// worker could be started. Spinning threads only help with a core each, so there are never
+// more threads than online processors.
+static int startWorkerPool(worker_pool *Pool, int ThreadCount) {
+    memset(Pool, 0, sizeof(*Pool));
+    pthread_mutex_init(&Pool->Mutex, 0);
+    pthread_cond_init(&Pool->Wake, 0);
+    long Processors = sysconf(_SC_NPROCESSORS_ONLN);
+    if(Processors > 0 && ThreadCount > Processors) {
+        ThreadCount = (int)Processors;
+    }
+    if(ThreadCount > POOL_MAX_THREADS) {
+        ThreadCount = POOL_MAX_THREADS;
+    }
+
+    Pool->ThreadCount = 1;
+    for(int Thread = 1; Thread < ThreadCount; ++Thread) {
+        Pool->Workers[Thread] = (pool_worker){Pool, Thread};
+        if(pthread_create(Pool->Threads + Thread, 0, runPoolWorker, Pool->Workers + Thread) != 0) {
+            break;
+        }
+        ++Pool->ThreadCount;
+    }
+    return Pool->ThreadCount;
+}
+
+static void stopWorkerPool(worker_pool *Pool) {
+    if(Pool->ThreadCount <= 1) {
+        return;
+    }
+    pthread_mutex_lock(&Pool->Mutex);
+    Pool->Quit = true;
+    atomic_fetch_add(&Pool->Generation, 1);
+    pthread_cond_broadcast(&Pool->Wake);
+    pthread_mutex_unlock(&Pool->Mutex);
+    for(int Thread = 1; Thread < Pool->ThreadCount; ++Thread) {
+        pthread_join(Pool->Threads[Thread], 0);
+    }
+    Pool->ThreadCount = 1;
+}
+
+// NOTE(nox): Work stealing over the items [0, Count) of a job: every thread starts with a
+// contiguous share, takes items from its front and, once it is empty, steals from the back of
+// the other shares. A share is its [Begin, End) pair packed in one word and updated by CAS.
+typedef struct {
+    _Alignas(64) _Atomic uint64_t Range;
+} pool_share;
+
+static void sharePoolItems(worker_pool *Pool, pool_share *Shares, uint32_t Count) {
+    int ThreadCount = Pool->ThreadCount > 1 ? Pool->ThreadCount : 1;
+    for(int Thread = 0; Thread < ThreadCount; ++Thread) {
+        uint64_t Begin = (uint64_t)Count*Thread/ThreadCount;
+        uint64_t End = (uint64_t)Count*(Thread + 1)/ThreadCount;
+        atomic_store_explicit(&Shares[Thread].Range, End << 32 | Begin, memory_order_relaxed);
+    }
+}
+
+static bool takeFromShare(pool_share *Share, bool Steal, uint32_t *Item) {
+    uint64_t Range = atomic_load_explicit(&Share->Range, memory_order_relaxed);
+    for(;;) {
+        uint32_t Begin = (uint32_t)Range, End = (uint32_t)(Range >> 32);
+        if(Begin >= End) {
+            return false;
+        }
+        uint64_t Taken = Steal ? ((uint64_t)(End - 1) << 32 | Begin) : ((uint64_t)End << 32 | (Begin + 1));
+        if(atomic_compare_exchange_weak_explicit(&Share->Range, &Range, Taken, memory_order_relaxed,
+                                                 memory_order_relaxed)) {
+            *Item = Steal ? End - 1 : Begin;
+            return true;
+        }
+    }
+}
+
+static bool nextPoolItem(worker_pool *Pool, pool_share *Shares, int Thread, uint32_t *Item) {
+    if(takeFromShare(Shares + Thread, false, Item)) {
+        return true;
+    }
+    for(int Offset = 1; Offset < Pool->ThreadCount; ++Offset) {
+        if(takeFromShare(Shares + (Thread + Offset) % Pool->ThreadCount, true, Item)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// NOTE(nox): Runs Job on every thread of the pool and returns when all of them have finished
+static void runPoolJob(worker_pool *Pool, pool_job *Job, void *Data) {
+    if(Pool->ThreadCount <= 1) {
+        Job(Data, 0);
+        return;
+    }
+
+    Pool->Job = Job;
+    Pool->Data = Data;
+    atomic_fetch_add(&Pool->Generation, 1);
+    if(atomic_load(&Pool->Sleepers)) {
+        pthread_mutex_lock(&Pool->Mutex);
+        pthread_cond_broadcast(&Pool->Wake);
+        pthread_mutex_unlock(&Pool->Mutex);
+    }
+    Job(Data, 0);
+    poolBarrier(Pool, 0);
+}
+
+#endif